@@ -18,7 +18,6 @@ void main() {
 #version 460 core
 
 layout(location = 0) out vec4 fragColor;
-uniform vec2 iResolution;
 
 uniform sampler2D screenTexture;
 uniform sampler2D lastFrameTex;
@@ -18,12 +18,19 @@ void main() {
 #version 460 core
 
 layout(location = 0) out vec4 fragColor;
-uniform vec2 iResolution;
+
+// Per frame constants, one buffer bound to every program (see FrameData in Main.cpp)
+layout (std140, binding=0) uniform FrameData {
+    vec3 cameraPos;
+    float iTime;
+    vec3 cameraRot;
+    int iFrame;
+    vec2 padding; // iResolution, unused here but keeps accumulate at its std140 offset
+    int accumulate;
+};
 
 uniform sampler2D screenTexture;
 uniform int shouldTonemap;
-uniform int iFrame;
-uniform int accumulate;
 
 in vec2 TexCoords;
 
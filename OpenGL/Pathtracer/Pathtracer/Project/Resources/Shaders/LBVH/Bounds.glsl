@@ -0,0 +1,68 @@
+#COMPUTE_SHADER
+#version 450 core
+
+// Bounds of every triangle centroid, the Morton codes are quantized inside them
+
+layout(local_size_x = 256) in;
+
+// Only the positions are read, see the vertices in pathtracer.glsl
+#ifndef COMPACT_VERTICES
+#define COMPACT_VERTICES 0
+#endif
+
+#if COMPACT_VERTICES
+struct CompactVertex {
+    float px, py, pz;
+    uint normal;
+    uint uv;
+};
+
+layout (std430, binding=11) readonly buffer meshData {
+    CompactVertex vertices[];
+};
+
+vec3 vertexPosition(uint index) { return vec3(vertices[index].px, vertices[index].py, vertices[index].pz); }
+#else
+struct Vertex {
+    vec4 position;
+    vec4 uv;
+    vec4 normal;
+};
+
+layout (std430, binding=11) readonly buffer meshData {
+    Vertex vertices[];
+};
+
+vec3 vertexPosition(uint index) { return vertices[index].position.xyz; }
+#endif
+
+layout (std430, binding=19) readonly buffer meshIndicesData {
+    uint vertexIndices[];
+};
+
+// Floats encoded as ordered uints so atomicMin/atomicMax work on them
+layout (std430, binding=20) buffer centroidBoundsData {
+    uint centroidMin[3];
+    uint centroidMax[3];
+};
+
+uniform uint trianglesCount;
+uniform uint indicesStart;
+
+uint OrderedUInt(float f) {
+    uint u = floatBitsToUint(f);
+    return (u & 0x80000000u) != 0u ? ~u : u | 0x80000000u;
+}
+
+void main() {
+    uint tri = gl_GlobalInvocationID.x;
+    if (tri >= trianglesCount) return;
+
+    uint v = indicesStart + tri * 3u;
+    vec3 center = (vertexPosition(vertexIndices[v]) + vertexPosition(vertexIndices[v+1]) + vertexPosition(vertexIndices[v+2])) / 3.0;
+
+    for (int a = 0; a < 3; a++) {
+        atomicMin(centroidMin[a], OrderedUInt(center[a]));
+        atomicMax(centroidMax[a], OrderedUInt(center[a]));
+    }
+}
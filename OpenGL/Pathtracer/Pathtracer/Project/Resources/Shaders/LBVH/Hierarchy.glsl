@@ -0,0 +1,113 @@
+#COMPUTE_SHADER
+#version 450 core
+
+// Karras 2012 hierarchy over the sorted Morton codes, one invocation per interior node.
+// Nodes must be stored as child pairs (right = left + 1), so interior node i puts its children at slots 2i + 1 and 2i + 2,
+// every node lives in the pair slot of its parent and the root in slot 0
+
+layout(local_size_x = 256) in;
+
+struct SortPair {
+    uint key;
+    uint value;
+};
+
+struct BVHNode {
+    vec3 aabbMin;
+    int leftFirst;
+    vec3 aabbMax;
+    int primCount;
+};
+
+// Links used by Refit.glsl to climb from the leaves
+struct NodeLinks {
+    uint leafSlot;
+    uint leafParent;
+    uint interiorSlot;
+    uint interiorParent;
+    uint visits;
+};
+
+layout (std430, binding=13) writeonly buffer bvhData {
+    BVHNode bvhNodes[];
+};
+
+layout (std430, binding=21) readonly buffer pairsData {
+    SortPair pairs[];
+};
+
+layout (std430, binding=24) buffer linksData {
+    NodeLinks links[];
+};
+
+uniform uint trianglesCount;
+
+// Length of the common prefix of two keys, the indices break ties between equal codes
+int Delta(int i, int j) {
+    if (j < 0 || j >= int(trianglesCount)) return -1;
+    uint a = pairs[i].key, b = pairs[j].key;
+    if (a == b) return 32 + 31 - findMSB(uint(i ^ j));
+    return 31 - findMSB(a ^ b);
+}
+
+void main() {
+    int i = int(gl_GlobalInvocationID.x);
+    if (i >= int(trianglesCount) - 1) return;
+
+    // Direction and other end of the range
+    int d = Delta(i, i + 1) - Delta(i, i - 1) >= 0 ? 1 : -1;
+    int deltaMin = Delta(i, i - d);
+    int lMax = 2;
+    while (Delta(i, i + lMax * d) > deltaMin) lMax *= 2;
+    int l = 0;
+    for (int t = lMax / 2; t >= 1; t /= 2)
+        if (Delta(i, i + (l + t) * d) > deltaMin) l += t;
+    int j = i + l * d;
+
+    // Split position
+    int deltaNode = Delta(i, j);
+    int s = 0;
+    int t = l;
+    do {
+        t = (t + 1) / 2;
+        if (Delta(i, i + (s + t) * d) > deltaNode) s += t;
+    } while (t > 1);
+    int split = i + s * d + min(d, 0);
+
+    uint leftSlot = uint(2 * i + 1);
+    uint rightSlot = leftSlot + 1u;
+
+    // Children indices are root relative, like the CPU BVH. Leaves hold a single triangle, so they point at it directly
+    if (min(i, j) == split) {
+        bvhNodes[leftSlot].leftFirst = int(pairs[split].value);
+        bvhNodes[leftSlot].primCount = 1;
+        links[split].leafSlot = leftSlot;
+        links[split].leafParent = uint(i);
+    }
+    else {
+        bvhNodes[leftSlot].leftFirst = 2 * split + 1;
+        bvhNodes[leftSlot].primCount = 0;
+        links[split].interiorSlot = leftSlot;
+        links[split].interiorParent = uint(i);
+    }
+
+    if (max(i, j) == split + 1) {
+        bvhNodes[rightSlot].leftFirst = int(pairs[split + 1].value);
+        bvhNodes[rightSlot].primCount = 1;
+        links[split + 1].leafSlot = rightSlot;
+        links[split + 1].leafParent = uint(i);
+    }
+    else {
+        bvhNodes[rightSlot].leftFirst = 2 * (split + 1) + 1;
+        bvhNodes[rightSlot].primCount = 0;
+        links[split + 1].interiorSlot = rightSlot;
+        links[split + 1].interiorParent = uint(i);
+    }
+
+    links[i].visits = 0u;
+    if (i == 0) {
+        bvhNodes[0].leftFirst = 1;
+        bvhNodes[0].primCount = 0;
+        links[0].interiorSlot = 0u;
+    }
+}
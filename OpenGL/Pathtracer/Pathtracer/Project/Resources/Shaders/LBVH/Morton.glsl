@@ -0,0 +1,86 @@
+#COMPUTE_SHADER
+#version 450 core
+
+// 30 bit Morton code of every triangle centroid, paired with the triangle index for the sort
+
+layout(local_size_x = 256) in;
+
+struct SortPair {
+    uint key;
+    uint value;
+};
+
+// Only the positions are read, see the vertices in pathtracer.glsl
+#ifndef COMPACT_VERTICES
+#define COMPACT_VERTICES 0
+#endif
+
+#if COMPACT_VERTICES
+struct CompactVertex {
+    float px, py, pz;
+    uint normal;
+    uint uv;
+};
+
+layout (std430, binding=11) readonly buffer meshData {
+    CompactVertex vertices[];
+};
+
+vec3 vertexPosition(uint index) { return vec3(vertices[index].px, vertices[index].py, vertices[index].pz); }
+#else
+struct Vertex {
+    vec4 position;
+    vec4 uv;
+    vec4 normal;
+};
+
+layout (std430, binding=11) readonly buffer meshData {
+    Vertex vertices[];
+};
+
+vec3 vertexPosition(uint index) { return vertices[index].position.xyz; }
+#endif
+
+layout (std430, binding=19) readonly buffer meshIndicesData {
+    uint vertexIndices[];
+};
+
+layout (std430, binding=20) readonly buffer centroidBoundsData {
+    uint centroidMin[3];
+    uint centroidMax[3];
+};
+
+layout (std430, binding=21) writeonly buffer pairsData {
+    SortPair pairs[];
+};
+
+uniform uint trianglesCount;
+uniform uint indicesStart;
+
+float OrderedFloat(uint u) {
+    return uintBitsToFloat((u & 0x80000000u) != 0u ? u & 0x7FFFFFFFu : ~u);
+}
+
+// Inserts two zero bits after each of the 10 lower bits
+uint ExpandBits(uint v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+void main() {
+    uint tri = gl_GlobalInvocationID.x;
+    if (tri >= trianglesCount) return;
+
+    vec3 bMin = vec3(OrderedFloat(centroidMin[0]), OrderedFloat(centroidMin[1]), OrderedFloat(centroidMin[2]));
+    vec3 bMax = vec3(OrderedFloat(centroidMax[0]), OrderedFloat(centroidMax[1]), OrderedFloat(centroidMax[2]));
+
+    uint v = indicesStart + tri * 3u;
+    vec3 center = (vertexPosition(vertexIndices[v]) + vertexPosition(vertexIndices[v+1]) + vertexPosition(vertexIndices[v+2])) / 3.0;
+    vec3 extent = max(bMax - bMin, vec3(1e-20));
+    uvec3 cell = uvec3(clamp((center - bMin) / extent * 1024.0, 0.0, 1023.0));
+
+    pairs[tri] = SortPair(ExpandBits(cell.x) * 4u + ExpandBits(cell.y) * 2u + ExpandBits(cell.z), tri);
+}
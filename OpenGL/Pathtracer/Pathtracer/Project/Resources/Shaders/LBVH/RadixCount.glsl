@@ -0,0 +1,39 @@
+#COMPUTE_SHADER
+#version 450 core
+
+// Radix sort pass 1/3: digit histogram of every block of 256 keys
+
+layout(local_size_x = 256) in;
+
+struct SortPair {
+    uint key;
+    uint value;
+};
+
+layout (std430, binding=21) readonly buffer pairsData {
+    SortPair pairs[];
+};
+
+// Digit major: histograms[digit * blocksCount + block], so its scan gives every block its output offsets
+layout (std430, binding=23) writeonly buffer histogramsData {
+    uint histograms[];
+};
+
+uniform uint trianglesCount;
+uniform uint blocksCount;
+uniform uint digitShift;
+
+shared uint counts[16];
+
+void main() {
+    uint local = gl_LocalInvocationID.x;
+    uint i = gl_GlobalInvocationID.x;
+
+    if (local < 16u) counts[local] = 0u;
+    barrier();
+
+    if (i < trianglesCount) atomicAdd(counts[(pairs[i].key >> digitShift) & 15u], 1u);
+    barrier();
+
+    if (local < 16u) histograms[local * blocksCount + gl_WorkGroupID.x] = counts[local];
+}
@@ -0,0 +1,42 @@
+#COMPUTE_SHADER
+#version 450 core
+
+// Radix sort pass 2/3: exclusive scan of the histograms, dispatched as a single work group
+
+layout(local_size_x = 256) in;
+
+layout (std430, binding=23) buffer histogramsData {
+    uint histograms[];
+};
+
+uniform uint blocksCount;
+
+shared uint sums[256];
+
+void main() {
+    uint local = gl_LocalInvocationID.x;
+    uint total = 16u * blocksCount;
+    uint segment = (total + 255u) / 256u;
+    uint first = min(local * segment, total);
+    uint last = min(first + segment, total);
+
+    uint sum = 0u;
+    for (uint i = first; i < last; i++) sum += histograms[i];
+    sums[local] = sum;
+    barrier();
+
+    // Hillis-Steele scan of the segment sums
+    for (uint offset = 1u; offset < 256u; offset <<= 1) {
+        uint value = local >= offset ? sums[local - offset] : 0u;
+        barrier();
+        sums[local] += value;
+        barrier();
+    }
+
+    uint prefix = sums[local] - sum;
+    for (uint i = first; i < last; i++) {
+        uint count = histograms[i];
+        histograms[i] = prefix;
+        prefix += count;
+    }
+}
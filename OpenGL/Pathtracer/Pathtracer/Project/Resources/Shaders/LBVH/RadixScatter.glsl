@@ -0,0 +1,46 @@
+#COMPUTE_SHADER
+#version 450 core
+
+// Radix sort pass 3/3: stable scatter of every key to its block offset plus its rank inside the block
+
+layout(local_size_x = 256) in;
+
+struct SortPair {
+    uint key;
+    uint value;
+};
+
+layout (std430, binding=21) readonly buffer pairsData {
+    SortPair pairs[];
+};
+
+layout (std430, binding=22) writeonly buffer sortedPairsData {
+    SortPair sortedPairs[];
+};
+
+layout (std430, binding=23) readonly buffer histogramsData {
+    uint histograms[];
+};
+
+uniform uint trianglesCount;
+uniform uint blocksCount;
+uniform uint digitShift;
+
+shared uint digits[256];
+
+void main() {
+    uint local = gl_LocalInvocationID.x;
+    uint i = gl_GlobalInvocationID.x;
+
+    SortPair pair = i < trianglesCount ? pairs[i] : SortPair(0u, 0u);
+    uint digit = i < trianglesCount ? (pair.key >> digitShift) & 15u : 16u;
+    digits[local] = digit;
+    barrier();
+
+    if (i >= trianglesCount) return;
+
+    uint rank = 0u;
+    for (uint j = 0u; j < local; j++) rank += digits[j] == digit ? 1u : 0u;
+
+    sortedPairs[histograms[digit * blocksCount + gl_WorkGroupID.x] + rank] = pair;
+}
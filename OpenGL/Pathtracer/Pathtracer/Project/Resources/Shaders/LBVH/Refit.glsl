@@ -0,0 +1,98 @@
+#COMPUTE_SHADER
+#version 450 core
+
+// Bottom up bounds, one invocation per leaf: the second child to finish computes its parent bounds and keeps climbing
+
+layout(local_size_x = 256) in;
+
+struct BVHNode {
+    vec3 aabbMin;
+    int leftFirst;
+    vec3 aabbMax;
+    int primCount;
+};
+
+struct NodeLinks {
+    uint leafSlot;
+    uint leafParent;
+    uint interiorSlot;
+    uint interiorParent;
+    uint visits;
+};
+
+// Only the positions are read, see the vertices in pathtracer.glsl
+#ifndef COMPACT_VERTICES
+#define COMPACT_VERTICES 0
+#endif
+
+#if COMPACT_VERTICES
+struct CompactVertex {
+    float px, py, pz;
+    uint normal;
+    uint uv;
+};
+
+layout (std430, binding=11) readonly buffer meshData {
+    CompactVertex vertices[];
+};
+
+vec3 vertexPosition(uint index) { return vec3(vertices[index].px, vertices[index].py, vertices[index].pz); }
+#else
+struct Vertex {
+    vec4 position;
+    vec4 uv;
+    vec4 normal;
+};
+
+layout (std430, binding=11) readonly buffer meshData {
+    Vertex vertices[];
+};
+
+vec3 vertexPosition(uint index) { return vertices[index].position.xyz; }
+#endif
+
+layout (std430, binding=19) readonly buffer meshIndicesData {
+    uint vertexIndices[];
+};
+
+layout (std430, binding=13) coherent buffer bvhData {
+    BVHNode bvhNodes[];
+};
+
+layout (std430, binding=24) coherent buffer linksData {
+    NodeLinks links[];
+};
+
+uniform uint trianglesCount;
+uniform uint indicesStart;
+
+void main() {
+    uint leaf = gl_GlobalInvocationID.x;
+    if (leaf >= trianglesCount) return;
+
+    // A single triangle mesh has no interior nodes, its leaf is the root
+    uint slot = trianglesCount == 1u ? 0u : links[leaf].leafSlot;
+    if (trianglesCount == 1u) { bvhNodes[0].leftFirst = 0; bvhNodes[0].primCount = 1; }
+
+    uint v = indicesStart + uint(bvhNodes[slot].leftFirst) * 3u;
+    vec3 p0 = vertexPosition(vertexIndices[v]), p1 = vertexPosition(vertexIndices[v+1]), p2 = vertexPosition(vertexIndices[v+2]);
+    bvhNodes[slot].aabbMin = min(p0, min(p1, p2));
+    bvhNodes[slot].aabbMax = max(p0, max(p1, p2));
+
+    if (trianglesCount == 1u) return;
+
+    uint node = links[leaf].leafParent;
+    while (true) {
+        memoryBarrierBuffer();
+        // The first child to get here leaves, its sibling may still be writing its bounds
+        if (atomicAdd(links[node].visits, 1u) == 0u) return;
+
+        slot = links[node].interiorSlot;
+        int left = bvhNodes[slot].leftFirst;
+        bvhNodes[slot].aabbMin = min(bvhNodes[left].aabbMin, bvhNodes[left + 1].aabbMin);
+        bvhNodes[slot].aabbMax = max(bvhNodes[left].aabbMax, bvhNodes[left + 1].aabbMax);
+
+        if (node == 0u) return;
+        node = links[node].interiorParent;
+    }
+}
@@ -19,19 +19,30 @@ void main() {
 
 layout(location = 0) out vec4 fragColor;
 
-uniform vec2 iResolution;
-uniform float iTime;
-uniform int iFrame;
+// Per frame constants, one buffer bound to every program (see FrameData in Main.cpp)
+layout (std140, binding=0) uniform FrameData {
+    vec3 cameraPos;
+    float iTime;
+    vec3 cameraRot;
+    int iFrame;
+    vec2 iResolution;
+    int accumulate;
+};
+
 uniform sampler2D lastFrameTex;
 
 in vec2 TexCoords;
 
-uniform vec3 cameraPos;
-uniform vec3 cameraRot;
-
+// One per mesh group, every mesh is packed in the same buffers (see MeshInfo in Scene.h)
 struct MeshInfo {
-    vec4 vCount; // vec4 because gotta satisfy std430
-    vec4 gPos;
+    int indicesStart; // Into vertexIndices[], the triangles start at indicesStart / 3
+    int indicesCount;
+    int bvhRoot; // Node indices in the mesh BVH are relative to it
+    int verticesStart; // Added to its vertexIndices[]
+    vec4 gPos; // xyz: position, w: scale
+    int texture; // Layer of meshTextures for its material, -1 for none
+    int material; // Of the triangles without an MTL material
+    int materialsStart; // MTL material n of the mesh is materials[materialsStart + n - 1]
 };
 
 struct Vertex {
@@ -40,25 +51,127 @@ struct Vertex {
     vec4 normal;
 };
 
-struct ObjectInfo {
-    vec4 pos;
-    float type;
-    float matIndex;
-    float size;
-    float w;
+// First vertex and edges, the geometric normal cross(edge1, edge2) is packed in the w components
+struct Triangle {
+    vec4 v0;
+    vec4 edge1;
+    vec4 edge2;
+};
+
+// Analytic objects, uploaded by Scene split by type: spheres as a plain vec4(center, radius * radius) (spheresData below),
+// boxes as this struct (BoxData in Scene.h)
+struct BoxData {
+    vec4 center;
+    vec4 halfExtents;
+};
+
+struct BVHNode {
+    vec3 aabbMin;
+    int leftFirst; // Interior: left child (right = left + 1) | Leaf: first triangle
+    vec3 aabbMax;
+    int primCount; // 0 for interior nodes
 };
 
 layout (std430, binding=10) readonly buffer meshInfoData {
    MeshInfo mInfo[];
 };
 
+// Vertex encoding, injected at load: 1 reads the CompactVertex Scene::UploadMeshes packs with compactVertices
+#ifndef COMPACT_VERTICES
+#define COMPACT_VERTICES 0
+#endif
+
+#if COMPACT_VERTICES
+// Position, octahedral normal as 2 snorm16 and uv as 2 halfs (see CompactVertex in OBJLoader.h)
+struct CompactVertex {
+    float px, py, pz;
+    uint normal;
+    uint uv;
+};
+
+layout (std430, binding=11) readonly buffer meshData {
+    CompactVertex vertices[];
+};
+
+vec3 octahedralDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+Vertex meshVertex(int index) {
+    CompactVertex v = vertices[index];
+    return Vertex(vec4(v.px, v.py, v.pz, 0.0), vec4(unpackHalf2x16(v.uv), 0.0, 0.0), vec4(octahedralDecode(unpackSnorm2x16(v.normal)), 0.0));
+}
+#else
 layout (std430, binding=11) readonly buffer meshData
 { 
   Vertex vertices[];
 };
 
-layout (std430, binding=12) readonly buffer objsData {
-    ObjectInfo objsInfo[];
+Vertex meshVertex(int index) { return vertices[index]; }
+#endif
+
+// 3 per triangle into vertices[], which holds every distinct vertex once
+layout (std430, binding=19) readonly buffer meshIndicesData {
+    uint vertexIndices[];
+};
+
+// Same order as vertexIndices[], one entry per 3 indices (see TriangleData in OBJLoader.h)
+layout (std430, binding=16) readonly buffer trianglesData {
+    Triangle triangles[];
+};
+
+// Center and radius squared
+layout (std430, binding=12) readonly buffer spheresData {
+    vec4 spheres[];
+};
+
+layout (std430, binding=17) readonly buffer boxesData {
+    BoxData boxes[];
+};
+
+// Material of every sphere, then of every box
+layout (std430, binding=18) readonly buffer objectMaterialsData {
+    int objectMaterials[];
+};
+
+// Same order as triangles[]: 0 for the mesh material, n for its n-th MTL material
+layout (std430, binding=26) readonly buffer triangleMaterialsData {
+    uint triangleMaterials[];
+};
+
+// Mesh BVH width, injected at load: 2 is the binary BVH, 4 and 8 are the quantized wide BVH (see WideBVH.h)
+#ifndef BVH_WIDTH
+#define BVH_WIDTH 2
+#endif
+
+#if BVH_WIDTH > 2
+#define WIDE_NODE_UINTS (BVH_WIDTH == 4 ? 16 : 24)
+#define WIDE_STACK_SIZE 64 // WideBVH::StackSize, the CPU build splits the meshes whose traversal would need more
+layout (std430, binding=13) readonly buffer bvhData {
+    uint wideNodes[];
+};
+#else
+layout (std430, binding=13) readonly buffer bvhData {
+    BVHNode bvhNodes[];
+};
+#endif
+
+// Top level BVH over every ObjectInfo and mesh instance
+layout (std430, binding=14) readonly buffer tlasData {
+    BVHNode tlasNodes[];
+};
+
+// TLAS primitives: the type in the top 2 bits, then the index into spheres, boxes or mInfo
+#define SPHERE_PRIM 0u
+#define BOX_PRIM 1u
+#define MESH_PRIM 2u
+#define PRIM_TYPE_SHIFT 30
+#define PRIM_INDEX_MASK 0x3FFFFFFFu
+layout (std430, binding=15) readonly buffer tlasPrimsData {
+    uint tlasPrims[];
 };
 
 // Pathtracing
@@ -68,8 +181,6 @@ layout (std430, binding=12) readonly buffer objsData {
 //#define ACCUMULATE
 #define EXPOSURE 0.5
 
-uniform int accumulate;
-
 mat2 rotation(float angle) {
     return mat2(cos(angle), -sin(angle), sin(angle), cos(angle));
 }
@@ -156,12 +267,17 @@ struct Material {
     float metalicness;
     float IOR;
     float transmission;
-    
+    int texture; // Layer of meshTextures for the albedo, -1 for none
     
     vec3 emissiveColor;
     float emissivePower;
 };
 
+// Every material of the scene (see Material in Material.h), indexed by the objects and meshes
+layout (std430, binding=25) readonly buffer materialsData {
+    Material materials[];
+};
+
 struct SceneObject {
     vec3 pos;
     vec3 normal;
@@ -169,18 +285,6 @@ struct SceneObject {
     Material mat;
 };
 
-struct Sphere {
-    vec3 pos;
-    float radius;
-    Material mat;
-};
-
-struct Box {
-    vec3 pos;
-    vec3 size;
-    Material mat;
-};
-
 struct Scene {
     float d; // HitPoint Distance
     float d2; // Second HitPoint (if exists)
@@ -201,16 +305,16 @@ vec3 lightPos = (vec3(2.0, 3.0, 3.0))*1.0;
 
 
 
-float iSphere(in Ray ray, in Sphere sph, out float d2)
+float iSphere(in Ray ray, in vec4 sphere, out float d2)
 {
 	//sphere at origin has equation |xyz| = r
 	//sp |xyz|^2 = r^2.
 	//Since |xyz| = ro + t*rd (where t is the parameter to move along the ray),
 	//we have ro^2 + 2*ro*rd*t + t^2 - r2. This is a quadratic equation, so:
-	vec3 oc = ray.origin - sph.pos; //distance ray origin - sphere center
+	vec3 oc = ray.origin - sphere.xyz; //distance ray origin - sphere center
 	
 	float b = dot(oc, ray.dir);
-	float c = dot(oc, oc) - sph.radius * sph.radius; //sph.w is radius
+	float c = dot(oc, oc) - sphere.w; //sphere.w is the radius squared
 	float h = b*b - c; //Commonly known as delta. The term a is 1 so is not included.
 	
     const float missHit = -1.0;
@@ -255,85 +359,450 @@ vec3 triIntersect( in vec3 ro, in vec3 rd, in vec3 v0, in vec3 v1, in vec3 v2 )
     return vec3( t, u, v );
 }
 
+// triIntersect over a precomputed Triangle: no edges or normal to rebuild, returns only the distance
+float triIntersect( in vec3 ro, in vec3 rd, in Triangle tri )
+{
+    vec3  n = vec3(tri.v0.w, tri.edge1.w, tri.edge2.w);
+    vec3 rov0 = ro - tri.v0.xyz;
+    vec3  q = cross( rov0, rd );
+    float d = 1.0/dot( rd, n );
+    float u = d*dot( -q, tri.edge2.xyz );
+    float v = d*dot(  q, tri.edge1.xyz );
+    float t = d*dot( -n, rov0 );
+    return ( u<0.0 || v<0.0 || (u+v)>1.0 ) ? -1.0 : t;
+}
+
 bool miss(float hit) { return hit <= MIN_TRACE_DIST || hit > MAX_DIST; }
 
-uniform sampler2D meshTexture;
+// Slab test, returns the entry distance or MAX_DIST on a miss
+float iAABB(in vec3 ro, in vec3 invDir, in vec3 bMin, in vec3 bMax)
+{
+    vec3 t1 = (bMin - ro) * invDir;
+    vec3 t2 = (bMax - ro) * invDir;
+    vec3 tMin = min(t1, t2);
+    vec3 tMax = max(t1, t2);
+    float tN = max(max(tMin.x, tMin.y), tMin.z);
+    float tF = min(min(tMax.x, tMax.y), tMax.z);
+    return (tN > tF || tF < 0.0) ? MAX_DIST : tN;
+}
+
+#define BVH_STACK_SIZE 32
+// The GPU built (LBVH) trees have no depth limit: ties on the 30 Morton bits split on the triangle index,
+// so they can get 62 levels deep. Pushes past it are dropped rather than written out of bounds
+#define MESH_STACK_SIZE 64
+
+// Mesh BVH traversal, injected at load: 0 keeps a full stack per ray,
+// 1 is a restart trail with a BVH_SHORT_STACK_SIZE entries stack (0 entries makes it stackless). Binary BVH only
+#ifndef BVH_TRAVERSAL
+#define BVH_TRAVERSAL 0
+#endif
+#ifndef BVH_SHORT_STACK_SIZE
+#define BVH_SHORT_STACK_SIZE 4
+#endif
+
+// Closest hit against a mesh BVH. The tree is built in mesh space, so the ray is moved there instead of the vertices
+#if BVH_WIDTH > 2
+// One quantized bound of a child: group 0-2 is lo.xyz, 3-5 hi.xyz
+float wideQuantized(uint node, int group, int child)
+{
+    int byteIndex = group * BVH_WIDTH + child;
+    return float((wideNodes[node + 4u + uint(byteIndex / 4)] >> uint((byteIndex % 4) * 8)) & 0xFFu);
+}
+
+void meshTrace(in Ray ray, in int m, inout float d, inout int hitVertex)
+{
+    float scale = mInfo[m].gPos.w;
+    vec3 ro = (ray.origin - mInfo[m].gPos.xyz) / scale;
+    vec3 rd = ray.dir / scale; // Not normalized, keeps the hit distances in world units
+    vec3 invDir = 1.0 / rd;
+    int rootNode = mInfo[m].bvhRoot;
+    int vertexStart = mInfo[m].indicesStart;
+
+    int stack[WIDE_STACK_SIZE];
+    int stackPtr = 0;
+    stack[stackPtr++] = rootNode;
+
+    while (stackPtr > 0) {
+        uint node = uint(stack[--stackPtr]) * uint(WIDE_NODE_UINTS);
+        vec3 origin = uintBitsToFloat(uvec3(wideNodes[node], wideNodes[node+1u], wideNodes[node+2u]));
+        uint exponents = wideNodes[node+3u];
+        vec3 frameScale = uintBitsToFloat(uvec3(exponents & 0xFFu, (exponents >> 8) & 0xFFu, (exponents >> 16) & 0xFFu) << 23);
+        uint metaStart = node + 4u + uint(6 * BVH_WIDTH / 4);
+
+        // Leaves are intersected right away, interior children get sorted far to near on the stack
+        int hitCount = 0;
+        int hitNodes[BVH_WIDTH];
+        float hitDists[BVH_WIDTH];
+        for (int c = 0; c < BVH_WIDTH; c++) {
+            uint meta = wideNodes[metaStart + uint(c)];
+            if (meta == 0xFFFFFFFFu) break;
+
+            vec3 cMin = origin + vec3(wideQuantized(node, 0, c), wideQuantized(node, 1, c), wideQuantized(node, 2, c)) * frameScale;
+            vec3 cMax = origin + vec3(wideQuantized(node, 3, c), wideQuantized(node, 4, c), wideQuantized(node, 5, c)) * frameScale;
+            float dChild = iAABB(ro, invDir, cMin, cMax);
+            if (dChild >= d) continue;
+
+            if ((meta & 0x80000000u) != 0u) {
+                int first = vertexStart + int(meta & 0xFFFFFFu) * 3;
+                int count = int((meta >> 24) & 0x7Fu);
+                for (int i = first; i < first + count * 3; i += 3) {
+                    float triHit = triIntersect(ro, rd, triangles[i / 3]);
+                    if (miss(triHit) || triHit >= d) continue;
+                    d = triHit;
+                    hitVertex = i;
+                }
+                continue;
+            }
+
+            int h = hitCount++;
+            while (h > 0 && hitDists[h-1] < dChild) {
+                hitDists[h] = hitDists[h-1];
+                hitNodes[h] = hitNodes[h-1];
+                h--;
+            }
+            hitDists[h] = dChild;
+            hitNodes[h] = rootNode + int(meta);
+        }
+
+        for (int h = 0; h < hitCount; h++)
+            if (hitDists[h] < d && stackPtr < WIDE_STACK_SIZE) stack[stackPtr++] = hitNodes[h];
+    }
+}
+#elif BVH_TRAVERSAL == 1
+// Restart trail traversal (Laine 2010): bit L of the trail is set once the near child at depth 31 - L is done,
+// so when the short stack runs dry the ray restarts at the root and follows the trail down to the next far child.
+// Needs the tree depth to stay within 31 levels (BVH::MaxDepth), so not for the GPU built trees
+void meshTrace(in Ray ray, in int m, inout float d, inout int hitVertex)
+{
+    float scale = mInfo[m].gPos.w;
+    vec3 ro = (ray.origin - mInfo[m].gPos.xyz) / scale;
+    vec3 rd = ray.dir / scale; // Not normalized, keeps the hit distances in world units
+    vec3 invDir = 1.0 / rd;
+    int rootNode = mInfo[m].bvhRoot;
+    int vertexStart = mInfo[m].indicesStart;
+
+    if (iAABB(ro, invDir, bvhNodes[rootNode].aabbMin, bvhNodes[rootNode].aabbMax) >= d) return;
+
+#if BVH_SHORT_STACK_SIZE > 0
+    // Ring buffer, pushing onto a full stack drops the oldest entry
+    int shortStack[BVH_SHORT_STACK_SIZE];
+    int stackTop = 0;
+    int stackCount = 0;
+#endif
+    uint trail = 0u;
+    uint level = 0x80000000u;
+    int nodeIndex = rootNode;
+
+    while (true) {
+        BVHNode node = bvhNodes[nodeIndex];
+
+        if (node.primCount > 0) {
+            int first = vertexStart + node.leftFirst * 3;
+            for (int i = first; i < first + node.primCount * 3; i += 3) {
+                float triHit = triIntersect(ro, rd, triangles[i / 3]);
+                if (miss(triHit) || triHit >= d) continue;
+                d = triHit;
+                hitVertex = i;
+            }
+        }
+        else {
+            int nearChild = rootNode + node.leftFirst;
+            int farChild = nearChild + 1;
+            float dNear = iAABB(ro, invDir, bvhNodes[nearChild].aabbMin, bvhNodes[nearChild].aabbMax);
+            float dFar = iAABB(ro, invDir, bvhNodes[farChild].aabbMin, bvhNodes[farChild].aabbMax);
+            if (dFar < dNear) {
+                int tmp = nearChild; nearChild = farChild; farChild = tmp;
+                float tmpD = dNear; dNear = dFar; dFar = tmpD;
+            }
+
+            if (dNear < d) {
+                level >>= 1;
+                if (dFar >= d) {
+                    // A single child counts as the far one, its level is done once it is
+                    trail |= level;
+                    nodeIndex = nearChild;
+                }
+                else if ((trail & level) != 0u) nodeIndex = farChild;
+                else {
+#if BVH_SHORT_STACK_SIZE > 0
+                    shortStack[stackTop] = farChild;
+                    stackTop = (stackTop + 1) % BVH_SHORT_STACK_SIZE;
+                    stackCount = min(stackCount + 1, BVH_SHORT_STACK_SIZE);
+#endif
+                    nodeIndex = nearChild;
+                }
+                continue;
+            }
+        }
+
+        // Subtree done: bump the trail at this level, the carry pops every finished level above
+        trail = (trail & (0u - level)) + level;
+        if ((trail & 0x80000000u) != 0u) break;
+        level = trail & (0u - trail);
+
+#if BVH_SHORT_STACK_SIZE > 0
+        if (stackCount > 0) {
+            stackTop = (stackTop + BVH_SHORT_STACK_SIZE - 1) % BVH_SHORT_STACK_SIZE;
+            stackCount--;
+            nodeIndex = shortStack[stackTop];
+            continue;
+        }
+#endif
+        nodeIndex = rootNode;
+        level = 0x80000000u;
+    }
+}
+#else
+void meshTrace(in Ray ray, in int m, inout float d, inout int hitVertex)
+{
+    float scale = mInfo[m].gPos.w;
+    vec3 ro = (ray.origin - mInfo[m].gPos.xyz) / scale;
+    vec3 rd = ray.dir / scale; // Not normalized, keeps the hit distances in world units
+    vec3 invDir = 1.0 / rd;
+    int rootNode = mInfo[m].bvhRoot;
+    int vertexStart = mInfo[m].indicesStart;
+
+    if (iAABB(ro, invDir, bvhNodes[rootNode].aabbMin, bvhNodes[rootNode].aabbMax) >= d) return;
+
+    int stack[MESH_STACK_SIZE];
+    int stackPtr = 0;
+    stack[stackPtr++] = rootNode;
+
+    while (stackPtr > 0) {
+        BVHNode node = bvhNodes[stack[--stackPtr]];
+
+        if (node.primCount > 0) {
+            int first = vertexStart + node.leftFirst * 3;
+            for (int i = first; i < first + node.primCount * 3; i += 3) {
+                float triHit = triIntersect(ro, rd, triangles[i / 3]);
+                if (miss(triHit) || triHit >= d) continue;
+                d = triHit;
+                hitVertex = i;
+            }
+            continue;
+        }
+
+        // Visit the nearest child first, skip children behind the closest hit so far
+        int nearChild = rootNode + node.leftFirst;
+        int farChild = nearChild + 1;
+        float dNear = iAABB(ro, invDir, bvhNodes[nearChild].aabbMin, bvhNodes[nearChild].aabbMax);
+        float dFar = iAABB(ro, invDir, bvhNodes[farChild].aabbMin, bvhNodes[farChild].aabbMax);
+        if (dFar < dNear) {
+            int tmp = nearChild; nearChild = farChild; farChild = tmp;
+            float tmpD = dNear; dNear = dFar; dFar = tmpD;
+        }
+        if (dFar < d && stackPtr < MESH_STACK_SIZE) stack[stackPtr++] = farChild;
+        if (dNear < d && stackPtr < MESH_STACK_SIZE) stack[stackPtr++] = nearChild;
+    }
+}
+#endif
+
+// Any hit against a mesh BVH for visibility rays: no child ordering, returns at the first triangle closer than tmax
+#if BVH_WIDTH > 2
+bool meshOccluded(in Ray ray, in int m, in float tmax)
+{
+    float scale = mInfo[m].gPos.w;
+    vec3 ro = (ray.origin - mInfo[m].gPos.xyz) / scale;
+    vec3 rd = ray.dir / scale;
+    vec3 invDir = 1.0 / rd;
+    int rootNode = mInfo[m].bvhRoot;
+    int vertexStart = mInfo[m].indicesStart;
+
+    int stack[WIDE_STACK_SIZE];
+    int stackPtr = 0;
+    stack[stackPtr++] = rootNode;
+
+    while (stackPtr > 0) {
+        uint node = uint(stack[--stackPtr]) * uint(WIDE_NODE_UINTS);
+        vec3 origin = uintBitsToFloat(uvec3(wideNodes[node], wideNodes[node+1u], wideNodes[node+2u]));
+        uint exponents = wideNodes[node+3u];
+        vec3 frameScale = uintBitsToFloat(uvec3(exponents & 0xFFu, (exponents >> 8) & 0xFFu, (exponents >> 16) & 0xFFu) << 23);
+        uint metaStart = node + 4u + uint(6 * BVH_WIDTH / 4);
+
+        for (int c = 0; c < BVH_WIDTH; c++) {
+            uint meta = wideNodes[metaStart + uint(c)];
+            if (meta == 0xFFFFFFFFu) break;
+
+            vec3 cMin = origin + vec3(wideQuantized(node, 0, c), wideQuantized(node, 1, c), wideQuantized(node, 2, c)) * frameScale;
+            vec3 cMax = origin + vec3(wideQuantized(node, 3, c), wideQuantized(node, 4, c), wideQuantized(node, 5, c)) * frameScale;
+            if (iAABB(ro, invDir, cMin, cMax) >= tmax) continue;
+
+            if ((meta & 0x80000000u) == 0u) {
+                if (stackPtr < WIDE_STACK_SIZE) stack[stackPtr++] = rootNode + int(meta);
+                continue;
+            }
+
+            int first = vertexStart + int(meta & 0xFFFFFFu) * 3;
+            int count = int((meta >> 24) & 0x7Fu);
+            for (int i = first; i < first + count * 3; i += 3) {
+                float triHit = triIntersect(ro, rd, triangles[i / 3]);
+                if (!miss(triHit) && triHit < tmax) return true;
+            }
+        }
+    }
+    return false;
+}
+#else
+bool meshOccluded(in Ray ray, in int m, in float tmax)
+{
+    float scale = mInfo[m].gPos.w;
+    vec3 ro = (ray.origin - mInfo[m].gPos.xyz) / scale;
+    vec3 rd = ray.dir / scale;
+    vec3 invDir = 1.0 / rd;
+    int rootNode = mInfo[m].bvhRoot;
+    int vertexStart = mInfo[m].indicesStart;
+
+    int stack[MESH_STACK_SIZE];
+    int stackPtr = 0;
+    if (iAABB(ro, invDir, bvhNodes[rootNode].aabbMin, bvhNodes[rootNode].aabbMax) < tmax) stack[stackPtr++] = rootNode;
+
+    while (stackPtr > 0) {
+        BVHNode node = bvhNodes[stack[--stackPtr]];
+
+        if (node.primCount > 0) {
+            int first = vertexStart + node.leftFirst * 3;
+            for (int i = first; i < first + node.primCount * 3; i += 3) {
+                float triHit = triIntersect(ro, rd, triangles[i / 3]);
+                if (!miss(triHit) && triHit < tmax) return true;
+            }
+            continue;
+        }
+
+        int leftChild = rootNode + node.leftFirst;
+        if (stackPtr < MESH_STACK_SIZE && iAABB(ro, invDir, bvhNodes[leftChild].aabbMin, bvhNodes[leftChild].aabbMax) < tmax) stack[stackPtr++] = leftChild;
+        if (stackPtr < MESH_STACK_SIZE && iAABB(ro, invDir, bvhNodes[leftChild+1].aabbMin, bvhNodes[leftChild+1].aabbMax) < tmax) stack[stackPtr++] = leftChild + 1;
+    }
+    return false;
+}
+#endif
+
+uniform sampler2DArray meshTextures;
 //uniform int mCount; // The meshes count coming from SSBO
-#define SPHERE_TYPE 0
-#define BOX_TYPE 1
 
 Scene world(Ray ray) {
     Scene scene;
     scene.d = MAX_DIST;
     scene.d2 = MAX_DIST;
-    
-    Material m1 = Material(vec4(0.1, 0.7, 0.9, 1.0), 0.0, 1.0, 0.0, 0.0, 0.0, vec3(0.0), 0.0);
-    Material m2 = Material(vec4(1.0, 0.9, 0.8, 1.0), 0.0, 2.0, 0.0, 0.0, 0.0, vec3(0.0), 0.0);
-    Material tranM = Material(vec4(1.0), 0.7, 0.2, 0.0, 1.0, 0.4, vec3(0.0), 0.0);
-    Material wRefM = Material(vec4(0.9), 0.9, 0.9, 0.0, 1.0, 0.0, vec3(0.0), 0.0);
-    
-    Material wlm = Material(vec4(0.0), 0.0, 1.0, 0.0, 0.0, 0.0, vec3(1.0), 20.0);
-    Material lm = Material(vec4(0.0), 0.0, 1.0, 0.0, 0.0, 0.0, vec3(0.9, 0.5, 0.1), 50.0);
-    Material bLight = Material(vec4(0.0), 0.0, 1.0, 0.0, 0.0, 0.0, vec3(0.0, 0.5, 1.0), 5.0); 
-    Material pRefM = Material(vec4(0.9, 0.5, 0.8, 1.0), 0.8, 0.7, 0.0, 1.0, 0.0, vec3(0.0), 0.0);
-    Material rLight = Material(vec4(0.0), 0.0, 1.0, 0.0, 0.0, 0.0, vec3(1.0, 0.2, 0.1), 2.0); 
-    Material gLight = Material(vec4(0.0), 0.0, 1.0, 0.0, 0.0, 0.0, vec3(0.2, 0.9, 0.8), 1.0);
-    
-    Material[] mats = Material[] ( m1, m2, tranM, wRefM, pRefM, wlm, lm, rLight, gLight, bLight );
-
-    for(int i = 0; i < objsInfo.length(); i++) {
-        ObjectInfo objInfo = objsInfo[i];
-        if(objInfo.type == SPHERE_TYPE) {
-            Sphere sph = Sphere(objInfo.pos.xyz, objInfo.size, mats[int(objInfo.matIndex)]);
-            float d2;
-            float sphereHit = iSphere(ray, sph, d2);
-            if (miss(sphereHit)) continue;
-            scene.d = min(scene.d, sphereHit);
-            vec3 normal = normalize(ray.origin - objInfo.pos.xyz + scene.d * ray.dir);
-            vec3 normal2 = normalize(ray.origin - objInfo.pos.xyz + d2 * ray.dir);
-            SceneObject obj = SceneObject(objInfo.pos.xyz, normal, normal2, sph.mat);
-            if (scene.d == sphereHit) { 
-                scene.closestHit = obj;
-                scene.d2 = d2;
+
+    int hitVertex = -1;
+    int hitMesh = -1;
+    int spheresCount = spheres.length();
+
+    vec3 invDir = 1.0 / ray.dir;
+    int stack[BVH_STACK_SIZE];
+    int stackPtr = 0;
+    if (tlasNodes.length() > 0 && iAABB(ray.origin, invDir, tlasNodes[0].aabbMin, tlasNodes[0].aabbMax) < scene.d) stack[stackPtr++] = 0;
+
+    while (stackPtr > 0) {
+        BVHNode node = tlasNodes[stack[--stackPtr]];
+
+        if (node.primCount == 0) {
+            int nearChild = node.leftFirst;
+            int farChild = nearChild + 1;
+            float dNear = iAABB(ray.origin, invDir, tlasNodes[nearChild].aabbMin, tlasNodes[nearChild].aabbMax);
+            float dFar = iAABB(ray.origin, invDir, tlasNodes[farChild].aabbMin, tlasNodes[farChild].aabbMax);
+            if (dFar < dNear) {
+                int tmp = nearChild; nearChild = farChild; farChild = tmp;
+                float tmpD = dNear; dNear = dFar; dFar = tmpD;
             }
+            if (dFar < scene.d) stack[stackPtr++] = farChild;
+            if (dNear < scene.d) stack[stackPtr++] = nearChild;
+            continue;
         }
-        else if(objInfo.type == BOX_TYPE) {
-            Box box = Box(objInfo.pos.xyz, vec3(objInfo.size), mats[int(objInfo.matIndex)]);
-            vec3 normal = vec3(0.0);
-            float boxHit = boxIntersection(ray.origin - objInfo.pos.xyz, ray.dir, box.size, normal);
-            if (miss(boxHit)) continue;
-            scene.d = min(scene.d, boxHit);
-            SceneObject obj = SceneObject(objInfo.pos.xyz, normalize(normal), vec3(0.0), box.mat);
-            if (scene.d == boxHit) scene.closestHit = obj;
+
+        for (int p = node.leftFirst; p < node.leftFirst + node.primCount; p++) {
+            uint primType = tlasPrims[p] >> PRIM_TYPE_SHIFT;
+            int i = int(tlasPrims[p] & PRIM_INDEX_MASK);
+
+            if (primType == MESH_PRIM) {
+                int lastHitVertex = hitVertex;
+                meshTrace(ray, i, scene.d, hitVertex);
+                if (hitVertex != lastHitVertex) hitMesh = i;
+                continue;
+            }
+
+            if (primType == SPHERE_PRIM) {
+                vec4 sphere = spheres[i];
+                float d2;
+                float sphereHit = iSphere(ray, sphere, d2);
+                if (miss(sphereHit) || sphereHit > scene.d) continue;
+                // Normals and material only for a closer hit
+                scene.d = sphereHit;
+                scene.d2 = d2;
+                vec3 normal = normalize(ray.origin - sphere.xyz + sphereHit * ray.dir);
+                vec3 normal2 = normalize(ray.origin - sphere.xyz + d2 * ray.dir);
+                scene.closestHit = SceneObject(sphere.xyz, normal, normal2, materials[objectMaterials[i]]);
+                hitVertex = -1;
+            }
+            else {
+                BoxData box = boxes[i];
+                vec3 normal = vec3(0.0);
+                float boxHit = boxIntersection(ray.origin - box.center.xyz, ray.dir, box.halfExtents.xyz, normal);
+                if (miss(boxHit) || boxHit > scene.d) continue;
+                scene.d = boxHit;
+                scene.closestHit = SceneObject(box.center.xyz, normalize(normal), vec3(0.0), materials[objectMaterials[spheresCount + i]]);
+                hitVertex = -1;
+            }
         }
     }
 
-    Material texM = Material(vec4(0.0), 0.0, 1.0, 0.5, 0.0, 0.0, vec3(0.0), 0.0);
-    for(int m = 0; m < mInfo.length(); m++) {
-        for (int i = int(mInfo[m-1].vCount.x); i < mInfo[m].vCount.x; i+=3) {
-            vec3 posOffset = mInfo[m].gPos.xyz;
-            float size = 3.0;
-            vec3 v1 = vertices[i].position.xyz * size;
-            vec3 v2 = vertices[i+1].position.xyz * size;
-            vec3 v3 = vertices[i+2].position.xyz * size;
-            //v1.xz *= rotation(3.14/4.0); v2.xz *= rotation(3.14/4.0); v3.xz *= rotation(3.14/4.0);
-            vec3 n = normalize(vertices[i].normal).xyz;
-            //n.xz *=  rotation(3.14/4.0);
-            float triHit = triIntersect(ray.origin - posOffset, ray.dir, v1, v2, v3).x;
-            if (miss(triHit)) continue;
-            scene.d = min(scene.d, triHit);
-
-            vec2 tC = vertices[i].uv.xy;
-            vec4 texColor = texture(meshTexture, tC);
-            texM.albedo = texColor;
-            SceneObject obj = SceneObject(posOffset, n, vec3(0.0), texM);
-            if (scene.d == triHit) scene.closestHit = obj;
-        }
+    // Material and normal are only needed for the closest triangle
+    if (hitVertex >= 0) {
+        MeshInfo mesh = mInfo[hitMesh];
+        Vertex vertex = meshVertex(mesh.verticesStart + int(vertexIndices[hitVertex]));
+        vec3 n = normalize(vertex.normal).xyz;
+        uint triangleMaterial = triangleMaterials[hitVertex / 3];
+        Material meshMaterial = triangleMaterial == 0u ? materials[mesh.material] : materials[mesh.materialsStart + int(triangleMaterial) - 1];
+        int textureLayer = triangleMaterial == 0u ? mesh.texture : meshMaterial.texture;
+        if (textureLayer >= 0) meshMaterial.albedo = texture(meshTextures, vec3(vertex.uv.xy, float(textureLayer)));
+        scene.closestHit = SceneObject(mesh.gPos.xyz, n, vec3(0.0), meshMaterial);
     }
 
     return scene;
 }
 
+// Visibility query: true when anything is hit closer than tmax. Unlike world(), it returns at the first hit found
+// and never builds normals or materials, so it is the one to use for shadow rays
+bool occluded(Ray ray, float tmax)
+{
+    vec3 invDir = 1.0 / ray.dir;
+
+    int stack[BVH_STACK_SIZE];
+    int stackPtr = 0;
+    if (tlasNodes.length() > 0 && iAABB(ray.origin, invDir, tlasNodes[0].aabbMin, tlasNodes[0].aabbMax) < tmax) stack[stackPtr++] = 0;
+
+    while (stackPtr > 0) {
+        BVHNode node = tlasNodes[stack[--stackPtr]];
+
+        if (node.primCount == 0) {
+            int leftChild = node.leftFirst;
+            if (iAABB(ray.origin, invDir, tlasNodes[leftChild].aabbMin, tlasNodes[leftChild].aabbMax) < tmax) stack[stackPtr++] = leftChild;
+            if (iAABB(ray.origin, invDir, tlasNodes[leftChild+1].aabbMin, tlasNodes[leftChild+1].aabbMax) < tmax) stack[stackPtr++] = leftChild + 1;
+            continue;
+        }
+
+        for (int p = node.leftFirst; p < node.leftFirst + node.primCount; p++) {
+            uint primType = tlasPrims[p] >> PRIM_TYPE_SHIFT;
+            int i = int(tlasPrims[p] & PRIM_INDEX_MASK);
+
+            if (primType == MESH_PRIM) {
+                if (meshOccluded(ray, i, tmax)) return true;
+                continue;
+            }
+
+            float hit;
+            if (primType == SPHERE_PRIM) {
+                float d2;
+                hit = iSphere(ray, spheres[i], d2);
+            }
+            else hit = iAABB(ray.origin, invDir, boxes[i].center.xyz - boxes[i].halfExtents.xyz, boxes[i].center.xyz + boxes[i].halfExtents.xyz);
+
+            if (!miss(hit) && hit < tmax) return true;
+        }
+    }
+    return false;
+}
+
 vec3 worldNormals(Ray ray, float world) {
     return normalize(ray.origin + ray.dir * world);
 }
@@ -501,7 +970,8 @@ void main()
     vec3 lastFrame = texture(lastFrameTex, gl_FragCoord.xy/iResolution.xy).rgb;
     vec3 finalColor = finalRender.rgb;
     
-    if(accumulate == 1) finalColor += lastFrame;
+    // Frame 0 starts the sum over, dropping what was accumulated before a restart
+    if(accumulate == 1 && iFrame > 0) finalColor += lastFrame;
     
     fragColor = vec4(finalColor, 1.0);
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <algorithm>
 
 #include <GLAD/glad.h>
 #include <glfw3.h>
@@ -8,6 +9,9 @@
 #include "Models/Camera.h"
 #include "Models/OBJLoader.h"
 #include "Models/Framebuffer.h"
+#include "Models/Scene.h"
+#include "Models/LBVH.h"
+#include "Models/ShaderWatcher.h"
 
 #include "ImGui/imgui.h"
 #include "ImGui/imgui_impl_glfw.h"
@@ -18,6 +22,17 @@
 #define WINDOW_WIDTH 1920.0f//960.0f
 #define WINDOW_HEIGHT 1080.0f//540.0f
 
+// Matches the FrameData uniform block (std140, binding 0) shared by the canvas and post processing shaders
+struct FrameData {
+	glm::vec3 cameraPos;
+	float iTime;
+	glm::vec3 cameraRot;
+	int iFrame;
+	glm::vec2 iResolution;
+	int accumulate;
+	int padding;
+};
+
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
 	//currentWidth = width; currentHeight = height;
@@ -85,53 +100,78 @@ int main() {
 	glEnableVertexAttribArray(1);
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride * sizeof(float), (void*)(sizeof(float)*3));
 
-	OBJLoader triangleObj = OBJLoader(Resources("3D Models/lpKnight.obj"));
-	float icoPos[4] = { 0.0, 0.5, 0.0, 0.0 };
-	auto triangleObjData = triangleObj.GetVerticesAsSSBuffer();
-
-	constexpr unsigned int objs = 1;
-	constexpr int mInfoStride = 8;
-
-	struct MeshInfo {
-		float info[4];
-		float gPos[4];
-	};
-
-	MeshInfo mInfos[objs * mInfoStride] = { 
-		{
-			(triangleObjData.verticesCount), 0.0f, 0.0f, 0.0f,
-			icoPos[0], icoPos[1], icoPos[2], icoPos[3]
-		}
-	};
-	
-	unsigned int lObjsSize = triangleObjData.verticesSize;
-	float* lObjsVertices = triangleObjData.vertices;
-
-	Texture pyObjTex = Texture(Resources("Textures/Gold.jpg"));
-	pyObjTex.Load();
-
-	SSBO meshLayoutSSBO;
-	meshLayoutSSBO.Bind(10);
-	meshLayoutSSBO.SendData((long)(objs * mInfoStride * sizeof(float)), (void*)(mInfos) );
-	meshLayoutSSBO.Unbind();
-
-	SSBO meshSSBO;
-	meshSSBO.Bind(11);
-	meshSSBO.SendData((long)(lObjsSize * sizeof(float)), (void*)lObjsVertices);
-	meshSSBO.Unbind();
-
-	struct ObjectInfo {
-		glm::vec4 position;
-		float type;
-		float matIndex;
-		float size;
-		float w = 0.0f;
-		ObjectInfo(glm::vec4 position, unsigned int type, unsigned int matIndex, float size):
-			position(position), type(type), matIndex(matIndex), size(size) {};
-	};
+	// Width 2 traverses the binary BVH, 4 or 8 collapse it into a quantized wide BVH.
+	// Spatial splits (SBVH) help meshes with long thin triangles, at the cost of duplicated triangles
+	BVHSettings meshBVHSettings = BVHSettings();
+	meshBVHSettings.width = 2;
+	meshBVHSettings.spatialSplits = false;
+	meshBVHSettings.overlapBudget = 1e-5f;
+	meshBVHSettings.threadsCount = 0; // Loader threads, for the OBJ parse (conversion included) and the BVH build. 0 uses every hardware thread
+	const int meshBVHWidth = meshBVHSettings.width;
+
+	// Mesh BVH traversal in pathtracer.glsl: 0 full stack, 1 restart trail with a short stack (CPU built binary BVH only)
+	const int meshTraversal = 0;
+	const int meshShortStackSize = 4;
+
+	// Mesh upload chunk: the mapped blocks of the binary mesh and BVH cache are sent (and paged in) this many bytes at a time,
+	// and the intersection triangles are computed into a staging buffer of this size. It doesn't bound the OBJ conversion
+	// or the BVH build, those hold the whole mesh in memory
+	const size_t meshUploadBudget = 16 << 20;
+
+	// Compact mesh vertices: octahedral normals and half float uvs, 20 bytes a vertex instead of 48, at a small precision cost
+	const bool meshCompactVertices = false;
+
+	// Created ahead of the mesh loading, so a compile (binary cache miss) runs in the background meanwhile. It's waited for on its first Bind
+	Shader canvasShader = Shader(Resources("Shaders/pathtracer.glsl"), {
+		"BVH_WIDTH " + std::to_string(meshBVHWidth),
+		"BVH_TRAVERSAL " + std::to_string(meshTraversal),
+		"BVH_SHORT_STACK_SIZE " + std::to_string(meshShortStackSize),
+		"COMPACT_VERTICES " + std::to_string((int)meshCompactVertices)
+	});
+
+	// The OBJ is converted to a binary mesh (again when the OBJ or the format changes), whose vertices and indices are mapped straight into the SSBOs.
+	// The BVH gets mapped from the BVH cache next to the asset when it's up to date
+	const char* meshPath = Resources("3D Models/lpKnight.ptmesh");
+	const char* objPath = Resources("3D Models/lpKnight.obj");
+	if (!OBJLoader::IsMeshCurrent(meshPath, objPath)) OBJLoader::ConvertToMesh(objPath, meshPath, meshBVHSettings.threadsCount);
+
+	double meshLoadStart = glfwGetTime();
+	OBJLoader triangleObj(meshPath, meshBVHSettings);
+	print("Mesh and BVH load time: " << (glfwGetTime() - meshLoadStart) * 1000.0 << "ms");
+
+	Scene scene;
+
+	// Materials table: albedo, specular, roughness, metalicness, IOR, transmission, emissive color and power
+	scene.AddMaterial(Material(glm::vec4(0.1, 0.7, 0.9, 1.0), 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, glm::vec3(0.0f), 0.0f));
+	scene.AddMaterial(Material(glm::vec4(1.0, 0.9, 0.8, 1.0), 0.0f, 2.0f, 0.0f, 0.0f, 0.0f, glm::vec3(0.0f), 0.0f));
+	scene.AddMaterial(Material(glm::vec4(1.0), 0.7f, 0.2f, 0.0f, 1.0f, 0.4f, glm::vec3(0.0f), 0.0f)); // Transparent
+	scene.AddMaterial(Material(glm::vec4(0.9), 0.9f, 0.9f, 0.0f, 1.0f, 0.0f, glm::vec3(0.0f), 0.0f)); // White reflective
+	scene.AddMaterial(Material(glm::vec4(0.9, 0.5, 0.8, 1.0), 0.8f, 0.7f, 0.0f, 1.0f, 0.0f, glm::vec3(0.0f), 0.0f)); // Pink reflective
+	scene.AddMaterial(Material(glm::vec4(0.0), 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, glm::vec3(1.0f), 20.0f)); // White light
+	scene.AddMaterial(Material(glm::vec4(0.0), 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, glm::vec3(0.9f, 0.5f, 0.1f), 50.0f)); // Light
+	scene.AddMaterial(Material(glm::vec4(0.0), 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, glm::vec3(1.0f, 0.2f, 0.1f), 2.0f)); // Red light
+	scene.AddMaterial(Material(glm::vec4(0.0), 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, glm::vec3(0.2f, 0.9f, 0.8f), 1.0f)); // Green light
+	scene.AddMaterial(Material(glm::vec4(0.0), 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, glm::vec3(0.0f, 0.5f, 1.0f), 5.0f)); // Blue light
+	const int texturedMaterial = scene.AddMaterial(Material(glm::vec4(0.0), 0.0f, 1.0f, 0.5f, 0.0f, 0.0f, glm::vec3(0.0f), 0.0f));
+	const int goldTexture = scene.AddTexture(Resources("Textures/Gold.jpg"));
+
+	// Every group of every mesh becomes an instance (position, scale), all of them packed in the same buffers.
+	// Their MTL materials and textures (if any) join the tables, the rest of the triangles get the textured material
+	scene.AddMesh(triangleObj, glm::vec4(0.0f, 0.5f, 0.0f, 3.0f), goldTexture, texturedMaterial);
+	if (!scene.UploadMeshes(meshUploadBudget, meshCompactVertices)) { glfwTerminate(); return -1; }
+
+	// Mesh textures are the layers of one array. Layers take the storage size, so the textures should share it
+	std::vector<std::string>& meshTexturePaths = scene.GetTexturePaths();
+	Texture meshTextures = Texture(meshTexturePaths.data(), (short unsigned int)meshTexturePaths.size());
+	meshTextures.BindArray(3);
+	meshTextures.LoadArrray(900, 599);
+
+	// GPU builder for animated meshes, same node layout as the CPU BVH. It builds the first mesh, in place of every packed BVH
+	// Without a mesh (it failed to load) it gets no triangles, and its toggle stays hidden
+	const MeshInfo gpuBVHMesh = scene.GetMeshes().empty() ? MeshInfo() : scene.GetMeshes()[0];
+	LBVH meshLBVH = LBVH(gpuBVHMesh.indicesCount / 3, meshCompactVertices);
+	bool gpuBVH = false;
 
-
-	std::vector<ObjectInfo> objsInfo = std::vector<ObjectInfo>();
 	ObjectInfo floorBox = ObjectInfo(glm::vec4(0.0, -0.7, 0.0, 0.0), 1, 0, 1.2f);
 	ObjectInfo l1Sph = ObjectInfo(glm::vec4(0.0f, 1.7f, -0.5f, 0.0f), 0, 6, 0.1f);
 	ObjectInfo lsBox = ObjectInfo(glm::vec4(-2.4f, 1.2f, 0.0f, 0.0f), 1, 1, 1.2f);
@@ -143,21 +183,19 @@ int main() {
 	ObjectInfo spSph = ObjectInfo(glm::vec4(-0.3f, 0.7f, -0.3f, 0.0f), 0, 3, 0.15f);
 	ObjectInfo pRefSph = ObjectInfo(glm::vec4(0.6f, 0.65f, -0.5f, 0.0f), 0, 4, 0.15f);
 	ObjectInfo lCube = ObjectInfo(glm::vec4(0.4f, 0.525f, -0.7f, 0.0f), 1, 7, 0.025f);
-	objsInfo.push_back(floorBox);
-	objsInfo.push_back(lsBox);
-	objsInfo.push_back(rsBox);
-	objsInfo.push_back(backBox);
-	objsInfo.push_back(topBox);
-	objsInfo.push_back(refSph);
-	objsInfo.push_back(l1Sph);
-	objsInfo.push_back(blSph);
-	objsInfo.push_back(spSph);
-	objsInfo.push_back(pRefSph);
-	objsInfo.push_back(lCube);
-	SSBO objsInfoSSBO;
-	//objsInfoSSBO.Bind(12);
-	//objsInfoSSBO.SendData(sizeof(objsInfo), (void*)objsInfo);
-	//objsInfoSSBO.Unbind();
+	scene.AddObject(floorBox);
+	scene.AddObject(lsBox);
+	scene.AddObject(rsBox);
+	scene.AddObject(backBox);
+	scene.AddObject(topBox);
+	scene.AddObject(refSph);
+	scene.AddObject(l1Sph);
+	scene.AddObject(blSph);
+	scene.AddObject(spSph);
+	scene.AddObject(pRefSph);
+	scene.AddObject(lCube);
+	std::vector<ObjectInfo>& objsInfo = scene.GetObjects();
+	std::vector<Material>& materials = scene.GetMaterials();
 
 	// SSBO = Global GPU Memory => Bigger, but Slower
 	// UBO = Local GPU Memory => Smaller, but Fasters
@@ -190,12 +228,19 @@ int main() {
 	bloomMixFB.Check();
 	bloomMixFB.Unbind();
 
-	pyObjTex.Bind();
-	Shader canvasShader = Shader(Resources("Shaders/pathtracer.glsl"));
-	canvasShader.Bind();
-	canvasShader.SetUniform2f("iResolution", WINDOW_WIDTH, WINDOW_HEIGHT);
-	canvasShader.SetUniformInt("meshTexture", 3);
-	pyObjTex.Unbind();
+	// Texture units, set again when a reload swaps the programs
+	auto setTextureUnits = [&]() {
+		canvasShader.Bind();
+		canvasShader.SetUniformInt("meshTextures", 3);
+		canvasShader.SetUniformInt("lastFrameTex", 0);
+
+		bloomMixFB.GetShader().Bind();
+		bloomMixFB.GetShader().SetUniformInt("lastFrameTex", 1);
+	};
+	setTextureUnits();
+
+	// Edited shaders compile in the background, the running programs render until the new ones link
+	ShaderWatcher shaderWatcher(Resources("Shaders"));
 
 	glm::mat4 mvp = glm::mat4(1.0f);
 	glm::mat4 proj = glm::ortho(0.0f, WINDOW_WIDTH, WINDOW_HEIGHT, 0.0f);
@@ -216,6 +261,14 @@ int main() {
 
 	float time = 0;
 	int currentFrame = -1;
+	bool firstFrame = true;
+
+	// Every per frame constant goes in a single upload, instead of a uniform call per program
+	FrameData frameData = FrameData();
+	frameData.iResolution = glm::vec2(WINDOW_WIDTH, WINDOW_HEIGHT);
+	UBO frameUBO = UBO();
+	frameUBO.Bind(0);
+	frameUBO.SendData(sizeof(FrameData), nullptr);
 
 	glm::vec3 lastCamPos = camera.GetPosition();
 	while (!glfwWindowShouldClose(window)) {
@@ -240,6 +293,11 @@ int main() {
 		bool accPress = ImGui::Checkbox("Accumulate", &accumulate);
 		ImGui::Text("PostProcessing");
 		ImGui::Checkbox("Bloom", &bloom);
+		ImGui::Text("Acceleration");
+		ImGui::Checkbox("Refit TLAS", &scene.GetRefit());
+		// The restart trail only tracks 31 levels, LBVH trees can get deeper
+		if (meshBVHWidth == 2 && meshTraversal == 0 && scene.GetMeshes().size() == 1) ImGui::Checkbox("GPU mesh BVH (every frame)", &gpuBVH);
+		ImGui::Text("TLAS SAH cost: %.2f%s", scene.GetTLAS().SAHCost(), scene.IsRebuilding() ? " (rebuilding)" : "");
 
 		ImGui::End();
 
@@ -249,21 +307,53 @@ int main() {
 			ObjectInfo* objInfo = &objsInfo[i];
 			ImGui::PushID(i);
 
-			ImGui::DragFloat4("Position", glm::value_ptr(objInfo->position), 0.1f);
-			ImGui::DragFloat("Type", &(objInfo->type), 1, 0, 1);
-			ImGui::DragFloat("Material Index", &(objInfo->matIndex), 1, 0, 5);
-			ImGui::DragFloat("Size", &(objInfo->size), 0.1f, 0.1f, 5);
+			bool changed = ImGui::DragFloat4("Position", glm::value_ptr(objInfo->position), 0.1f);
+			changed |= ImGui::DragFloat("Type", &(objInfo->type), 1, 0, 1);
+			changed |= ImGui::DragFloat("Material Index", &(objInfo->matIndex), 1, 0, (float)materials.size() - 1);
+			changed |= ImGui::DragFloat("Size", &(objInfo->size), 0.1f, 0.1f, 5);
+			if (changed) scene.MarkDirty(i);
 			ImGui::Separator();
 			ImGui::PopID();
 		}
 
 		ImGui::End();
 
-		objsInfoSSBO.Bind(12);
-		objsInfoSSBO.SendData(sizeof(ObjectInfo) * objsInfo.size(), (void*)objsInfo.data());
-		objsInfoSSBO.Unbind();
+		// Materials edits go up with the next scene update
+		ImGui::Begin("Materials");
 
-		if (accPress && accumulate) currentFrame = 0;
+		for (int i = 0; i < materials.size(); i++) {
+			Material* material = &materials[i];
+			ImGui::PushID(i);
+
+			ImGui::Text("Material %d", i);
+			ImGui::ColorEdit4("Albedo", glm::value_ptr(material->albedo));
+			ImGui::DragFloat("Specular", &(material->specular), 0.01f, 0, 1);
+			ImGui::DragFloat("Roughness", &(material->roughness), 0.01f, 0, 2);
+			ImGui::DragFloat("Metalicness", &(material->metalicness), 0.01f, 0, 1);
+			ImGui::DragFloat("IOR", &(material->IOR), 0.01f, 0, 3);
+			ImGui::DragFloat("Transmission", &(material->transmission), 0.01f, 0, 1);
+			ImGui::ColorEdit3("Emissive Color", glm::value_ptr(material->emissiveColor));
+			ImGui::DragFloat("Emissive Power", &(material->emissivePower), 0.1f, 0, 100);
+			if (material->texture >= 0) ImGui::Text("Texture layer %d", material->texture);
+			ImGui::Separator();
+			ImGui::PopID();
+		}
+
+		ImGui::End();
+
+		// Objects and materials can change through the UI, only the TLAS paths of the changed objects get refitted and only the changed ranges go up
+		const bool sceneChanged = scene.Update();
+
+		// A deforming mesh would rebuild here after updating its vertices
+		if (gpuBVH) { meshLBVH.Build(gpuBVHMesh.indicesStart); meshLBVH.Bind(13); }
+		else scene.BindMeshBVH();
+
+		for (const std::string& shaderPath : shaderWatcher.Poll()) Shader::Reload(shaderPath);
+		const bool shadersReloaded = Shader::SwapReloaded();
+		if (shadersReloaded) setTextureUnits();
+
+		// The accumulated image restarts (from frame 0) when the scene or the shaders changed
+		if ((accPress || sceneChanged || shadersReloaded) && accumulate) currentFrame = -1;
 
 		time = glfwGetTime();
 		currentFrame++;
@@ -271,17 +361,17 @@ int main() {
 		//mvp = glm::mat4(1.0f);
 		mvp = proj * model;
 
-		canvasShader.Bind();
 		//camera.set(glm::vec3(sin(time), 0.0f, cos(time)*0.5));
-		glm::vec3 cameraPos = camera.GetPosition();
-		glm::vec3 cameraRot = camera.GetRotation();
-		canvasShader.SetUniform3f("cameraPos", cameraPos.x, cameraPos.y, cameraPos.z);
-		canvasShader.SetUniform3f("cameraRot", cameraRot.x, cameraRot.y, cameraRot.z);
+		frameData.cameraPos = camera.GetPosition();
+		frameData.cameraRot = camera.GetRotation();
+		frameData.iTime = time;
+		frameData.iFrame = currentFrame;
+		frameData.accumulate = accumulate;
+		frameUBO.Bind(0);
+		frameUBO.SendSubData(0, sizeof(FrameData), &frameData);
+
+		canvasShader.Bind();
 		canvasShader.SetUniformMat4("MVP", mvp);
-		canvasShader.SetUniformFloat("iTime", time);
-		canvasShader.SetUniformInt("iFrame", currentFrame);
-		canvasShader.SetUniformInt("accumulate", accumulate);
-		canvasShader.SetUniformInt("lastFrameTex", 0);
 		glBindVertexArray(VAO);
 		glDrawArrays(GL_TRIANGLES, 0, count(canvasVertices, float));
 
@@ -289,9 +379,6 @@ int main() {
 		postFB.Bind(2);
 		fb.Draw(false, 0);
 		postFB.Unbind();
-		postFB.GetShader().Bind();
-		postFB.GetShader().SetUniformInt("iFrame", currentFrame);
-		postFB.GetShader().SetUniformInt("accumulate", accumulate);
 		if(bloom) {
 			bloomFilterFB.Bind(1);
 			postFB.Draw(true, 2);
@@ -302,9 +389,6 @@ int main() {
 			bloomFB.Draw(bloomFilterFB.GetFBTexture(), 0.01f, bloomBind);
 			finalBloomFB.Draw(false, bloomBind, bloomFB.GetBloomMipAt(0));
 
-			bloomMixFB.GetShader().Bind();
-			bloomMixFB.GetShader().SetUniformInt("iFrame", currentFrame);
-			bloomMixFB.GetShader().SetUniformInt("lastFrameTex", 1);
 			bloomMixFB.Draw(true, 2, 4);
 		}
 		else postFB.Draw(true, 2);
@@ -315,6 +399,12 @@ int main() {
 
 		glfwSwapBuffers(window);
 		glfwPollEvents();
+
+		// glfwGetTime counts from glfwInit
+		if (firstFrame) {
+			print("Time to first frame: " << glfwGetTime() * 1000.0 << "ms (" << Shader::GetCachedPrograms() << " programs from the binary cache, " << Shader::GetCompiledPrograms() << " compiled)");
+			firstFrame = false;
+		}
 	}
 
 	ImGui_ImplGlfw_Shutdown();
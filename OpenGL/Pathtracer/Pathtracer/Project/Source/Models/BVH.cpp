@@ -0,0 +1,348 @@
+#include "BVH.h"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+void BVH::Build(const std::vector<AABB>& primBounds, ThreadPool* pool) {
+	const unsigned int primCount = (unsigned int)primBounds.size();
+
+	this->nodes.clear();
+	this->parents.clear();
+	this->nodesCost = 0.0f;
+	this->primBounds = primBounds;
+	this->primIndices.resize(primCount);
+	std::iota(this->primIndices.begin(), this->primIndices.end(), 0u);
+
+	if (primCount == 0) return;
+
+	BuildContext context;
+	context.pool = pool;
+	context.nodesUsed = 1;
+
+	this->centroids.resize(primCount);
+	ParallelFor(context, primCount, BinningChunkSize, [this](int first, int count) {
+		for (int i = first; i < first + count; i++) this->centroids[i] = this->primBounds[i].Center();
+	});
+
+	// A binary tree with N leaves has at most 2N - 1 nodes, allocated up front so subtree tasks can take slots concurrently
+	this->nodes.resize(2 * primCount - 1);
+	this->parents.resize(2 * primCount - 1);
+
+	BVHNode& root = this->nodes[0];
+	root.leftFirst = 0;
+	root.primCount = primCount;
+	this->parents[0] = -1;
+
+	UpdateNodeBounds(0);
+	Subdivide(context, 0, 0);
+	if (pool) pool->Wait(context.subtrees);
+
+	this->nodes.resize(context.nodesUsed);
+	this->parents.resize(context.nodesUsed);
+	FinishTopology();
+
+	// Build only data
+	this->primBounds.clear();
+	this->primBounds.shrink_to_fit();
+	this->centroids.clear();
+	this->centroids.shrink_to_fit();
+}
+
+void BVH::UpdateNodeBounds(unsigned int nodeIndex) {
+	BVHNode& node = this->nodes[nodeIndex];
+
+	AABB bounds = AABB();
+	for (int i = 0; i < node.primCount; i++)
+		bounds.Grow(this->primBounds[this->primIndices[node.leftFirst + i]]);
+
+	node.aabbMin = bounds.min;
+	node.aabbMax = bounds.max;
+}
+
+int BVH::BinIndex(const glm::vec3& centroid, int axis, const AABB& centroidBounds) const {
+	const float scale = BinsCount / (centroidBounds.max[axis] - centroidBounds.min[axis]);
+	int bin = (int)((centroid[axis] - centroidBounds.min[axis]) * scale);
+	return std::min(BinsCount - 1, std::max(0, bin));
+}
+
+void BVH::ParallelFor(BuildContext& context, int count, int chunkSize, const std::function<void(int, int)>& function) const {
+	const int chunksCount = (count + chunkSize - 1) / chunkSize;
+	if (!context.pool || chunksCount <= 1) { function(0, count); return; }
+
+	TaskGroup chunks;
+	for (int c = 1; c < chunksCount; c++) {
+		const int first = c * chunkSize;
+		context.pool->Submit(chunks, [&function, first, chunkSize, count]() { function(first, std::min(chunkSize, count - first)); });
+	}
+	function(0, chunkSize);
+	context.pool->Wait(chunks);
+}
+
+float BVH::FindBestSplit(BuildContext& context, const BVHNode& node, int& axis, int& splitBin, AABB& centroidBounds) const {
+	// Top level nodes bin their primitives in chunks on the pool, every chunk into its own bins
+	const bool parallel = context.pool && node.primCount >= ParallelBinningSize;
+	const int chunkSize = parallel ? BinningChunkSize : node.primCount;
+	const int chunksCount = (node.primCount + chunkSize - 1) / chunkSize;
+
+	std::vector<AABB> chunksCentroidBounds = std::vector<AABB>(chunksCount);
+	ParallelFor(context, node.primCount, chunkSize, [&](int first, int count) {
+		AABB& bounds = chunksCentroidBounds[first / chunkSize];
+		for (int i = first; i < first + count; i++)
+			bounds.Grow(this->centroids[this->primIndices[node.leftFirst + i]]);
+	});
+
+	centroidBounds = AABB();
+	for (const AABB& bounds : chunksCentroidBounds) centroidBounds.Grow(bounds);
+
+	std::vector<Bins> chunksBins = std::vector<Bins>(chunksCount);
+	ParallelFor(context, node.primCount, chunkSize, [&](int first, int count) {
+		Bins& bins = chunksBins[first / chunkSize];
+		for (int i = first; i < first + count; i++) {
+			unsigned int primIndex = this->primIndices[node.leftFirst + i];
+			for (int a = 0; a < 3; a++) {
+				if (centroidBounds.max[a] == centroidBounds.min[a]) continue;
+				Bin& bin = bins.axis[a][BinIndex(this->centroids[primIndex], a, centroidBounds)];
+				bin.primCount++;
+				bin.bounds.Grow(this->primBounds[primIndex]);
+			}
+		}
+	});
+
+	Bins& bins = chunksBins[0];
+	for (int c = 1; c < chunksCount; c++) {
+		for (int a = 0; a < 3; a++) {
+			for (int b = 0; b < BinsCount; b++) {
+				bins.axis[a][b].primCount += chunksBins[c].axis[a][b].primCount;
+				bins.axis[a][b].bounds.Grow(chunksBins[c].axis[a][b].bounds);
+			}
+		}
+	}
+
+	float bestCost = FLT_MAX;
+	for (int a = 0; a < 3; a++) {
+		if (centroidBounds.max[a] == centroidBounds.min[a]) continue; // Flat along this axis, can't split
+
+		const Bin* axisBins = bins.axis[a];
+
+		// Sweep from both sides to get the area and count on each side of every bin plane
+		float leftArea[BinsCount - 1], rightArea[BinsCount - 1];
+		int leftCount[BinsCount - 1], rightCount[BinsCount - 1];
+		AABB leftBox, rightBox;
+		int leftSum = 0, rightSum = 0;
+		for (int i = 0; i < BinsCount - 1; i++) {
+			leftSum += axisBins[i].primCount;
+			leftCount[i] = leftSum;
+			leftBox.Grow(axisBins[i].bounds);
+			leftArea[i] = leftBox.Area();
+
+			rightSum += axisBins[BinsCount - 1 - i].primCount;
+			rightCount[BinsCount - 2 - i] = rightSum;
+			rightBox.Grow(axisBins[BinsCount - 1 - i].bounds);
+			rightArea[BinsCount - 2 - i] = rightBox.Area();
+		}
+
+		for (int i = 0; i < BinsCount - 1; i++) {
+			float planeCost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+			if (planeCost < bestCost) { bestCost = planeCost; axis = a; splitBin = i + 1; }
+		}
+	}
+
+	return bestCost;
+}
+
+void BVH::Subdivide(BuildContext& context, unsigned int nodeIndex, int depth) {
+	BVHNode& node = this->nodes[nodeIndex];
+	if (node.primCount <= 1 || depth >= MaxDepth) return;
+
+	int axis = 0, splitBin = 0;
+	AABB centroidBounds;
+	float splitCost = FindBestSplit(context, node, axis, splitBin, centroidBounds);
+
+	AABB nodeBounds = { node.aabbMin, node.aabbMax };
+	float noSplitCost = node.primCount * nodeBounds.Area();
+	if (splitCost >= noSplitCost) return;
+
+	// In place partition of the primitives by the chosen bin plane
+	auto first = this->primIndices.begin() + node.leftFirst;
+	auto middle = std::partition(first, first + node.primCount, [&](unsigned int primIndex) {
+		return BinIndex(this->centroids[primIndex], axis, centroidBounds) < splitBin;
+	});
+
+	int leftCount = (int)(middle - first);
+	if (leftCount == 0 || leftCount == node.primCount) return;
+
+	const int firstPrim = node.leftFirst;
+	const int primCount = node.primCount;
+	// Children are allocated as a pair so the shader can find the right child at left + 1
+	const unsigned int leftIndex = context.nodesUsed.fetch_add(2);
+
+	BVHNode& left = this->nodes[leftIndex];
+	BVHNode& right = this->nodes[leftIndex + 1];
+	left.leftFirst = firstPrim;
+	left.primCount = leftCount;
+	right.leftFirst = firstPrim + leftCount;
+	right.primCount = primCount - leftCount;
+	this->parents[leftIndex] = nodeIndex;
+	this->parents[leftIndex + 1] = nodeIndex;
+
+	node.leftFirst = leftIndex;
+	node.primCount = 0;
+
+	UpdateNodeBounds(leftIndex);
+	UpdateNodeBounds(leftIndex + 1);
+
+	// Big subtrees go to the pool, where idle workers can steal them
+	if (context.pool && leftCount >= ParallelSubtreeSize)
+		context.pool->Submit(context.subtrees, [this, &context, leftIndex, depth]() { Subdivide(context, leftIndex, depth + 1); });
+	else
+		Subdivide(context, leftIndex, depth + 1);
+
+	Subdivide(context, leftIndex + 1, depth + 1);
+}
+
+void BVH::FinishTopology() {
+	this->primLeaves.resize(this->primIndices.size());
+	for (int n = 0; n < this->nodes.size(); n++) {
+		const BVHNode& node = this->nodes[n];
+		this->nodesCost += NodeCost(node);
+		for (int i = 0; i < node.primCount; i++) this->primLeaves[this->primIndices[node.leftFirst + i]] = n;
+	}
+}
+
+float BVH::NodeCost(const BVHNode& node) const {
+	AABB bounds = { node.aabbMin, node.aabbMax };
+	return bounds.Area() * (node.IsLeaf() ? node.primCount * IntersectionCost : TraversalCost);
+}
+
+float BVH::SAHCost() const {
+	if (this->nodes.empty()) return 0.0f;
+	float rootArea = GetBounds().Area();
+	return rootArea > 0.0f ? this->nodesCost / rootArea : 0.0f;
+}
+
+void BVH::Refit(const std::vector<AABB>& primBounds, const std::vector<unsigned int>& changedPrims) {
+	for (unsigned int prim : changedPrims) {
+		int nodeIndex = this->primLeaves[prim];
+
+		while (nodeIndex != -1) {
+			BVHNode& node = this->nodes[nodeIndex];
+
+			AABB bounds = AABB();
+			if (node.IsLeaf()) {
+				for (int i = 0; i < node.primCount; i++) bounds.Grow(primBounds[this->primIndices[node.leftFirst + i]]);
+			}
+			else {
+				const BVHNode& left = this->nodes[node.leftFirst];
+				const BVHNode& right = this->nodes[node.leftFirst + 1];
+				bounds = { glm::min(left.aabbMin, right.aabbMin), glm::max(left.aabbMax, right.aabbMax) };
+			}
+
+			// The ancestors were already consistent with these bounds, nothing else changes up the path
+			if (bounds.min == node.aabbMin && bounds.max == node.aabbMax) break;
+
+			this->nodesCost -= NodeCost(node);
+			node.aabbMin = bounds.min;
+			node.aabbMax = bounds.max;
+			this->nodesCost += NodeCost(node);
+
+			nodeIndex = this->parents[nodeIndex];
+		}
+	}
+}
+
+void BVH::Refit(const std::vector<AABB>& primBounds) {
+	// Children are always allocated after their parent, so a reverse sweep is bottom up
+	this->nodesCost = 0.0f;
+	for (int n = (int)this->nodes.size() - 1; n >= 0; n--) {
+		BVHNode& node = this->nodes[n];
+
+		AABB bounds = AABB();
+		if (node.IsLeaf()) {
+			for (int i = 0; i < node.primCount; i++) bounds.Grow(primBounds[this->primIndices[node.leftFirst + i]]);
+		}
+		else {
+			const BVHNode& left = this->nodes[node.leftFirst];
+			const BVHNode& right = this->nodes[node.leftFirst + 1];
+			bounds = { glm::min(left.aabbMin, right.aabbMin), glm::max(left.aabbMax, right.aabbMax) };
+		}
+
+		node.aabbMin = bounds.min;
+		node.aabbMax = bounds.max;
+		this->nodesCost += NodeCost(node);
+	}
+}
+
+TraversalStats BVH::MeasureTraversal(const std::vector<glm::vec3>& triangles, int raysCount) const {
+	TraversalStats stats = TraversalStats();
+	if (this->nodes.empty() || raysCount <= 0) return stats;
+
+	auto intersectBox = [](const glm::vec3& origin, const glm::vec3& invDir, const BVHNode& node) {
+		glm::vec3 t0 = (node.aabbMin - origin) * invDir;
+		glm::vec3 t1 = (node.aabbMax - origin) * invDir;
+		glm::vec3 tMin = glm::min(t0, t1), tMax = glm::max(t0, t1);
+		float tNear = std::max(std::max(tMin.x, tMin.y), std::max(tMin.z, 0.0f));
+		float tFar = std::min(std::min(tMax.x, tMax.y), tMax.z);
+		return tNear <= tFar ? tNear : FLT_MAX;
+	};
+
+	// Moller-Trumbore
+	auto intersectTriangle = [&](const glm::vec3& origin, const glm::vec3& dir, unsigned int prim) {
+		const glm::vec3& v0 = triangles[prim * 3];
+		glm::vec3 e1 = triangles[prim * 3 + 1] - v0, e2 = triangles[prim * 3 + 2] - v0;
+		glm::vec3 p = glm::cross(dir, e2);
+		float det = glm::dot(e1, p);
+		if (std::abs(det) < 1e-12f) return FLT_MAX;
+		glm::vec3 s = origin - v0;
+		float u = glm::dot(s, p) / det;
+		glm::vec3 q = glm::cross(s, e1);
+		float v = glm::dot(dir, q) / det;
+		float t = glm::dot(e2, q) / det;
+		return (u < 0.0f || v < 0.0f || u + v > 1.0f || t <= 0.0f) ? FLT_MAX : t;
+	};
+
+	// Rays from a sphere around the tree towards random points inside it, the same set for every tree
+	const AABB bounds = GetBounds();
+	const glm::vec3 center = bounds.Center();
+	const float radius = glm::length(bounds.max - bounds.min);
+	std::mt19937 random = std::mt19937(7);
+	std::uniform_real_distribution<float> unit = std::uniform_real_distribution<float>(0.0f, 1.0f);
+
+	int nodesVisited = 0, trianglesTested = 0;
+	for (int r = 0; r < raysCount; r++) {
+		float z = unit(random) * 2.0f - 1.0f, phi = unit(random) * 6.2831853f;
+		glm::vec3 origin = center + radius * glm::vec3(std::sqrt(1.0f - z * z) * std::cos(phi), std::sqrt(1.0f - z * z) * std::sin(phi), z);
+		glm::vec3 target = bounds.min + (bounds.max - bounds.min) * glm::vec3(unit(random), unit(random), unit(random));
+		glm::vec3 dir = glm::normalize(target - origin);
+		glm::vec3 invDir = 1.0f / dir;
+
+		float closest = FLT_MAX;
+		int stack[64];
+		int stackPtr = 0;
+		stack[stackPtr++] = 0;
+		while (stackPtr > 0) {
+			const BVHNode& node = this->nodes[stack[--stackPtr]];
+			nodesVisited++;
+
+			if (node.IsLeaf()) {
+				for (int i = 0; i < node.primCount; i++) {
+					trianglesTested++;
+					closest = std::min(closest, intersectTriangle(origin, dir, this->primIndices[node.leftFirst + i]));
+				}
+				continue;
+			}
+
+			int nearChild = node.leftFirst, farChild = node.leftFirst + 1;
+			float dNear = intersectBox(origin, invDir, this->nodes[nearChild]);
+			float dFar = intersectBox(origin, invDir, this->nodes[farChild]);
+			if (dFar < dNear) { std::swap(nearChild, farChild); std::swap(dNear, dFar); }
+			if (dFar < closest) stack[stackPtr++] = farChild;
+			if (dNear < closest) stack[stackPtr++] = nearChild;
+		}
+	}
+
+	stats.nodesPerRay = (float)nodesVisited / raysCount;
+	stats.trianglesPerRay = (float)trianglesTested / raysCount;
+	stats.costPerRay = TraversalCost * stats.nodesPerRay + IntersectionCost * stats.trianglesPerRay;
+	return stats;
+}
@@ -0,0 +1,142 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include <cfloat>
+
+#include "glm/glm.hpp"
+
+#include "ThreadPool.h"
+
+struct AABB {
+	glm::vec3 min = glm::vec3(FLT_MAX);
+	glm::vec3 max = glm::vec3(-FLT_MAX);
+
+	void Grow(const glm::vec3& point) { min = glm::min(min, point); max = glm::max(max, point); }
+	void Grow(const AABB& box) { min = glm::min(min, box.min); max = glm::max(max, box.max); }
+
+	glm::vec3 Center() const { return (min + max) * 0.5f; }
+	bool Empty() const { return glm::any(glm::greaterThan(min, max)); }
+
+	float Area() const {
+		glm::vec3 e = max - min;
+		if (e.x < 0.0f) return 0.0f; // Empty box
+		return e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+};
+
+// Matches the BVHNode struct in pathtracer.glsl (std430, 32 bytes)
+struct BVHNode {
+	glm::vec3 aabbMin;
+	int leftFirst; // Interior: left child index (right = left + 1) | Leaf: first primitive index
+	glm::vec3 aabbMax;
+	int primCount; // 0 for interior nodes
+
+	bool IsLeaf() const { return primCount > 0; }
+};
+
+// Averages over the rays of BVH::MeasureTraversal
+struct TraversalStats {
+	float nodesPerRay = 0.0f;
+	float trianglesPerRay = 0.0f;
+	float costPerRay = 0.0f; // TraversalCost * nodes + IntersectionCost * triangles
+};
+
+// Binned SAH Bounding Volume Hierarchy over a list of primitive bounds
+class BVH {
+
+	std::vector<BVHNode> nodes = std::vector<BVHNode>();
+	std::vector<unsigned int> primIndices = std::vector<unsigned int>(); // Leaves reference primitives through this list
+
+	// Refit data
+	std::vector<int> parents = std::vector<int>(); // -1 for the root
+	std::vector<int> primLeaves = std::vector<int>(); // Leaf node of every primitive
+	float nodesCost = 0.0f; // Sum of every node SAH term, kept up to date by Refit
+
+	std::vector<AABB> primBounds;
+	std::vector<glm::vec3> centroids;
+
+public:
+	static constexpr int BinsCount = 16;
+	static constexpr int MaxDepth = 30; // Keeps the GPU traversal stack bounded
+	static constexpr float TraversalCost = 1.0f;
+	static constexpr float IntersectionCost = 1.0f;
+
+	// Parallel build thresholds, in primitives
+	static constexpr int ParallelSubtreeSize = 1024; // Smaller subtrees aren't worth a task
+	static constexpr int ParallelBinningSize = 1 << 16; // Top level nodes this big also bin in chunks
+	static constexpr int BinningChunkSize = 1 << 14;
+
+	BVH() {};
+	~BVH() {};
+
+	// Subtrees (and the binning of the top levels) are split across the pool when there is one
+	void Build(const std::vector<AABB>& primBounds, ThreadPool* pool = nullptr);
+
+	// SBVH (Stich et al. 2009): spatial splits clip triangles into both children where object splits would overlap.
+	// Spatial splits are only tried when the object split children overlap by more than overlapBudget of the root area,
+	// straddling triangles are referenced by both children, so the primitive indices may hold duplicates
+	void BuildSpatial(const std::vector<glm::vec3>& triangles, float overlapBudget = 1e-5f);
+
+	// Casts raysCount deterministic rays at the tree bounds, closest hit with near first traversal like meshTrace()
+	TraversalStats MeasureTraversal(const std::vector<glm::vec3>& triangles, int raysCount = 4096) const;
+
+	// Object split trees only, recomputes the bounds on the paths from the changed primitives leaves to the root, keeping the topology
+	void Refit(const std::vector<AABB>& primBounds, const std::vector<unsigned int>& changedPrims);
+	// Recomputes every node bounds bottom up
+	void Refit(const std::vector<AABB>& primBounds);
+
+	// SAH cost of the tree relative to its root area, it grows as refits degrade the tree
+	float SAHCost() const;
+
+private:
+	struct Bin {
+		AABB bounds;
+		int primCount = 0;
+	};
+
+	struct Bins {
+		Bin axis[3][BinsCount];
+	};
+
+	// Build only state shared between the subtree tasks
+	struct BuildContext {
+		ThreadPool* pool;
+		TaskGroup subtrees;
+		std::atomic<unsigned int> nodesUsed;
+	};
+
+	// A triangle, or the part of it inside bounds, for the spatial splits
+	struct Reference {
+		AABB bounds;
+		unsigned int prim;
+	};
+
+	struct SplitCandidate {
+		float cost = FLT_MAX;
+		int axis = 0;
+		int bin = 0; // Object splits
+		float position = 0.0f; // Spatial splits
+		AABB centroidBounds;
+		AABB leftBounds, rightBounds;
+	};
+
+	void UpdateNodeBounds(unsigned int nodeIndex);
+	void Subdivide(BuildContext& context, unsigned int nodeIndex, int depth);
+	float FindBestSplit(BuildContext& context, const BVHNode& node, int& axis, int& splitBin, AABB& centroidBounds) const;
+	void ParallelFor(BuildContext& context, int count, int chunkSize, const std::function<void(int, int)>& function) const;
+	int BinIndex(const glm::vec3& centroid, int axis, const AABB& centroidBounds) const;
+	void SubdivideSpatial(const std::vector<glm::vec3>& triangles, float minOverlap, unsigned int nodeIndex, std::vector<Reference>& refs, int depth);
+	SplitCandidate FindObjectSplit(const std::vector<Reference>& refs) const;
+	SplitCandidate FindSpatialSplit(const std::vector<glm::vec3>& triangles, const std::vector<Reference>& refs, const AABB& nodeBounds) const;
+	float NodeCost(const BVHNode& node) const;
+	void FinishTopology();
+
+public:
+	inline const std::vector<BVHNode>& GetNodes() const { return this->nodes; }
+	inline const std::vector<unsigned int>& GetPrimIndices() const { return this->primIndices; }
+	inline unsigned int GetNodesCount() const { return (unsigned int)this->nodes.size(); }
+	inline AABB GetBounds() const { return nodes.empty() ? AABB() : AABB{ nodes[0].aabbMin, nodes[0].aabbMax }; }
+};
+
+#endif // !BVH_H
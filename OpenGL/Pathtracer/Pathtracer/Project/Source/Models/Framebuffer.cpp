@@ -84,7 +84,6 @@ void FrameBuffer::Draw(bool shouldTonemap, unsigned int texSlot, int preLoadedTe
 	glm::mat4 model_scale = glm::scale(glm::mat4(1.0f), glm::vec3(width, height, 0.0f));
 
 	fbShader.SetUniformMat4("MVP", mvp*model_scale);
-	fbShader.SetUniform2f("iResolution", this->width, this->height);
 	fbShader.SetUniformInt("screenTexture", texSlot);
 	fbShader.SetUniformInt("shouldTonemap", (int)shouldTonemap);
 	glBindVertexArray(this->VAO);
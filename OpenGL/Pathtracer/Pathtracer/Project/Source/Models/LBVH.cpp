@@ -0,0 +1,124 @@
+#include "LBVH.h"
+
+#include "Source/Utils.h"
+
+// Bindings, matching the LBVH shaders
+#define LBVH_NODES_BIND 13
+#define LBVH_CENTROID_BOUNDS_BIND 20
+#define LBVH_PAIRS_BIND 21
+#define LBVH_SORTED_PAIRS_BIND 22
+#define LBVH_HISTOGRAMS_BIND 23
+#define LBVH_LINKS_BIND 24
+
+namespace {
+	// The shaders reading the mesh vertices decode them when they're compact
+	std::vector<std::string> VertexDefines(bool compactVertices) { return { "COMPACT_VERTICES " + std::to_string((int)compactVertices) }; }
+}
+
+LBVH::LBVH(unsigned int trianglesCount, bool compactVertices) :
+	trianglesCount(trianglesCount), blocksCount((trianglesCount + GroupSize - 1) / GroupSize),
+	boundsShader(Resources("Shaders/LBVH/Bounds.glsl"), VertexDefines(compactVertices)),
+	mortonShader(Resources("Shaders/LBVH/Morton.glsl"), VertexDefines(compactVertices)),
+	radixCountShader(Resources("Shaders/LBVH/RadixCount.glsl")),
+	radixScanShader(Resources("Shaders/LBVH/RadixScan.glsl")),
+	radixScatterShader(Resources("Shaders/LBVH/RadixScatter.glsl")),
+	hierarchyShader(Resources("Shaders/LBVH/Hierarchy.glsl")),
+	refitShader(Resources("Shaders/LBVH/Refit.glsl"), VertexDefines(compactVertices))
+{
+	this->nodesSSBO.Bind(LBVH_NODES_BIND);
+	this->nodesSSBO.SendData(GetNodesCount() * sizeof(BVHNode), nullptr);
+
+	for (int i = 0; i < 2; i++) {
+		this->pairsSSBO[i].Bind(LBVH_PAIRS_BIND);
+		this->pairsSSBO[i].SendData(trianglesCount * 2 * sizeof(unsigned int), nullptr);
+	}
+
+	this->histogramsSSBO.Bind(LBVH_HISTOGRAMS_BIND);
+	this->histogramsSSBO.SendData(this->blocksCount * (1 << RadixBits) * sizeof(unsigned int), nullptr);
+
+	// leaf slot, leaf parent, interior slot, interior parent, visits
+	this->linksSSBO.Bind(LBVH_LINKS_BIND);
+	this->linksSSBO.SendData(trianglesCount * 5 * sizeof(unsigned int), nullptr);
+	this->linksSSBO.Unbind();
+}
+
+void LBVH::Build(unsigned int indicesStart) {
+	if (this->trianglesCount == 0) return;
+
+	// Empty bounds, as ordered uints (see Bounds.glsl)
+	unsigned int emptyBounds[6] = { 0xFFFFFFFFu, 0xFFFFFFFFu, 0xFFFFFFFFu, 0u, 0u, 0u };
+	this->centroidBoundsSSBO.Bind(LBVH_CENTROID_BOUNDS_BIND);
+	this->centroidBoundsSSBO.SendData(sizeof(emptyBounds), emptyBounds);
+
+	this->boundsShader.Bind();
+	this->boundsShader.SetUniformUInt("trianglesCount", this->trianglesCount);
+	this->boundsShader.SetUniformUInt("indicesStart", indicesStart);
+	this->boundsShader.Dispatch(this->blocksCount);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	this->pairsSSBO[0].Bind(LBVH_PAIRS_BIND);
+	this->mortonShader.Bind();
+	this->mortonShader.SetUniformUInt("trianglesCount", this->trianglesCount);
+	this->mortonShader.SetUniformUInt("indicesStart", indicesStart);
+	this->mortonShader.Dispatch(this->blocksCount);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	Sort();
+
+	// The sort runs an even number of passes, the sorted pairs end up back in pairsSSBO[0]
+	this->pairsSSBO[0].Bind(LBVH_PAIRS_BIND);
+	this->nodesSSBO.Bind(LBVH_NODES_BIND);
+	this->linksSSBO.Bind(LBVH_LINKS_BIND);
+	this->hierarchyShader.Bind();
+	this->hierarchyShader.SetUniformUInt("trianglesCount", this->trianglesCount);
+	this->hierarchyShader.Dispatch((this->trianglesCount - 1 + GroupSize - 1) / GroupSize);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	this->refitShader.Bind();
+	this->refitShader.SetUniformUInt("trianglesCount", this->trianglesCount);
+	this->refitShader.SetUniformUInt("indicesStart", indicesStart);
+	this->refitShader.Dispatch(this->blocksCount);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void LBVH::Sort() {
+	static_assert((MortonBits + RadixBits - 1) / RadixBits % 2 == 0, "The radix sort must run an even number of passes");
+	const unsigned int passesCount = (MortonBits + RadixBits - 1) / RadixBits;
+
+	this->histogramsSSBO.Bind(LBVH_HISTOGRAMS_BIND);
+
+	for (unsigned int pass = 0; pass < passesCount; pass++) {
+		const unsigned int digitShift = pass * RadixBits;
+		this->pairsSSBO[pass % 2].Bind(LBVH_PAIRS_BIND);
+		this->pairsSSBO[(pass + 1) % 2].Bind(LBVH_SORTED_PAIRS_BIND);
+
+		this->radixCountShader.Bind();
+		this->radixCountShader.SetUniformUInt("trianglesCount", this->trianglesCount);
+		this->radixCountShader.SetUniformUInt("blocksCount", this->blocksCount);
+		this->radixCountShader.SetUniformUInt("digitShift", digitShift);
+		this->radixCountShader.Dispatch(this->blocksCount);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		this->radixScanShader.Bind();
+		this->radixScanShader.SetUniformUInt("blocksCount", this->blocksCount);
+		this->radixScanShader.Dispatch(1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		this->radixScatterShader.Bind();
+		this->radixScatterShader.SetUniformUInt("trianglesCount", this->trianglesCount);
+		this->radixScatterShader.SetUniformUInt("blocksCount", this->blocksCount);
+		this->radixScatterShader.SetUniformUInt("digitShift", digitShift);
+		this->radixScatterShader.Dispatch(this->blocksCount);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+}
+
+AABB LBVH::GetBounds() {
+	if (this->trianglesCount == 0) return AABB();
+
+	BVHNode root;
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	this->nodesSSBO.Bind(LBVH_NODES_BIND);
+	this->nodesSSBO.GetData(0, sizeof(BVHNode), &root);
+	return { root.aabbMin, root.aabbMax };
+}
@@ -0,0 +1,54 @@
+#ifndef LBVH_H
+#define LBVH_H
+
+#include "Shader.h"
+#include "BVH.h"
+
+// Linear BVH built on the GPU (Karras 2012), for meshes that change every frame:
+// Morton codes of the triangle centroids are radix sorted and turned into a binary hierarchy with one triangle per leaf.
+// Reads the vertices bound at 11 through the indices bound at 19 and writes BVHNodes in the same layout as the CPU BVH, so meshTrace() traverses either
+class LBVH {
+
+	unsigned int trianglesCount;
+	unsigned int blocksCount;
+
+	Shader boundsShader;
+	Shader mortonShader;
+	Shader radixCountShader;
+	Shader radixScanShader;
+	Shader radixScatterShader;
+	Shader hierarchyShader;
+	Shader refitShader;
+
+	SSBO nodesSSBO;
+	SSBO centroidBoundsSSBO;
+	SSBO pairsSSBO[2]; // Radix sort ping pong
+	SSBO histogramsSSBO;
+	SSBO linksSSBO;
+
+public:
+	static constexpr unsigned int GroupSize = 256; // local_size_x of every LBVH shader
+	static constexpr unsigned int RadixBits = 4;
+	static constexpr unsigned int MortonBits = 30;
+
+	// compactVertices reads the vertices as Scene::UploadMeshes packs them with it
+	LBVH(unsigned int trianglesCount, bool compactVertices = false);
+	~LBVH() {};
+
+	// indicesStart is the first index of the mesh in the bound vertex indices buffer
+	void Build(unsigned int indicesStart = 0);
+
+	// Binds the nodes for the pathtracer, like the CPU BVH nodes buffer
+	void Bind(unsigned int bind = 13) { this->nodesSSBO.Bind(bind); }
+
+	// Reads the root back, this waits for the build to finish
+	AABB GetBounds();
+
+private:
+	void Sort();
+
+public:
+	inline unsigned int GetNodesCount() const { return this->trianglesCount > 0 ? 2 * this->trianglesCount - 1 : 0; }
+};
+
+#endif // !LBVH_H
@@ -0,0 +1,91 @@
+#include "MappedFile.h"
+
+#include <cstdio>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const char* filepath) {
+	HANDLE file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return;
+	this->file = file;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) return;
+
+	this->mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!this->mapping) return;
+
+	this->data = (const unsigned char*)MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (this->data) this->size = (size_t)fileSize.QuadPart;
+}
+
+MappedFile::~MappedFile() {
+	if (this->data) UnmapViewOfFile(this->data);
+	if (this->mapping) CloseHandle(this->mapping);
+	if (this->file) CloseHandle(this->file);
+}
+
+bool StatFile(const char* filepath, uint64_t& size, int64_t& modifiedTime) {
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExA(filepath, GetFileExInfoStandard, &attributes)) return false;
+
+	size = (uint64_t)attributes.nFileSizeHigh << 32 | attributes.nFileSizeLow;
+	modifiedTime = (int64_t)((uint64_t)attributes.ftLastWriteTime.dwHighDateTime << 32 | attributes.ftLastWriteTime.dwLowDateTime); // 100 ns ticks
+	return true;
+}
+
+#else
+
+MappedFile::MappedFile(const char* filepath) {
+	this->file = open(filepath, O_RDONLY);
+	if (this->file == -1) return;
+
+	struct stat fileStat;
+	if (fstat(this->file, &fileStat) != 0 || fileStat.st_size == 0) return;
+
+	void* mapped = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_SHARED, this->file, 0);
+	if (mapped == MAP_FAILED) return;
+
+	this->data = (const unsigned char*)mapped;
+	this->size = (size_t)fileStat.st_size;
+}
+
+MappedFile::~MappedFile() {
+	if (this->data) munmap((void*)this->data, this->size);
+	if (this->file != -1) close(this->file);
+}
+
+bool StatFile(const char* filepath, uint64_t& size, int64_t& modifiedTime) {
+	struct stat fileStat;
+	if (stat(filepath, &fileStat) != 0) return false;
+
+	size = (uint64_t)fileStat.st_size;
+#ifdef __linux__
+	modifiedTime = (int64_t)fileStat.st_mtim.tv_sec * 1000000000 + fileStat.st_mtim.tv_nsec;
+#else
+	modifiedTime = (int64_t)fileStat.st_mtime;
+#endif
+	return true;
+}
+
+#endif
+
+bool ReplaceFile(const std::string& tempPath, const std::string& path) {
+	// Windows won't rename over an existing file, and won't remove it either while another process maps it
+	if (std::rename(tempPath.c_str(), path.c_str()) == 0) return true;
+	std::remove(path.c_str());
+	if (std::rename(tempPath.c_str(), path.c_str()) == 0) return true;
+	std::remove(tempPath.c_str());
+	return false;
+}
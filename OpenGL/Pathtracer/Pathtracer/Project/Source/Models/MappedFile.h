@@ -0,0 +1,41 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read only memory mapping of a whole file, shared between every process that maps it
+class MappedFile {
+
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#else
+	int file = -1;
+#endif
+
+public:
+	MappedFile(const char* filepath);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Empty files can't be mapped, they don't count as open
+	inline bool IsOpen() const { return this->data != nullptr; }
+	inline const unsigned char* GetData() const { return this->data; }
+	inline size_t GetSize() const { return this->size; }
+};
+
+// Files are written aside and renamed over the old one, so other processes never map (or read) a half written file.
+// The temporary file is removed when it can't replace the old one
+bool ReplaceFile(const std::string& tempPath, const std::string& path);
+
+// Size and last write time of a file, without opening it. The time is in the platform units, only good for comparing. False when it isn't there
+bool StatFile(const char* filepath, uint64_t& size, int64_t& modifiedTime);
+
+#endif // !MAPPED_FILE_H
@@ -0,0 +1,25 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include "glm/glm.hpp"
+
+// Matches the Material struct in pathtracer.glsl (std430), the entries of the Scene materials table
+struct Material {
+	glm::vec4 albedo = glm::vec4(1.0f);
+	float specular = 0.0f;
+	float roughness = 1.0f;
+	float metalicness = 0.0f;
+	float IOR = 1.0f;
+	float transmission = 0.0f;
+	int texture = -1; // Layer in the mesh textures array for the albedo, -1 for none
+	float padding[2] = {};
+	glm::vec3 emissiveColor = glm::vec3(0.0f);
+	float emissivePower = 0.0f;
+
+	Material() {};
+	Material(glm::vec4 albedo, float specular, float roughness, float metalicness, float IOR, float transmission, glm::vec3 emissiveColor, float emissivePower) :
+		albedo(albedo), specular(specular), roughness(roughness), metalicness(metalicness), IOR(IOR), transmission(transmission),
+		emissiveColor(emissiveColor), emissivePower(emissivePower) {};
+};
+
+#endif // !MATERIAL_H
@@ -3,6 +3,16 @@
 #include <fstream> // file stream
 #include <sstream> // string stream
 #include <ostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <charconv>
+#include <cmath>
+#include <unordered_map>
+
+#include "glm/packing.hpp"
+
+#include "Timer.h"
 
 #include "Source/Utils.h"
 
@@ -21,13 +31,255 @@ std::vector<std::string> split(std::string s, std::string separator) {
 }
 
 OBJLoader::OBJLoader(const char* filepath) {
+	Load(filepath, true);
+}
 
-	std::ifstream stream = std::ifstream(filepath);
+OBJLoader::OBJLoader(const char* filepath, const BVHSettings& settings) {
+	const uint64_t sourceHash = SourceKey(filepath);
+	if (LoadCache(filepath, settings, sourceHash)) return;
+
+	// A failed load leaves no groups, and nothing to build or cache
+	if (!Load(filepath, false, settings.threadsCount)) return;
+	BuildBVH(settings);
+	SaveCache(filepath, settings, sourceHash);
+}
+
+bool OBJLoader::Load(const char* filepath, bool vertexArray, unsigned int threadsCount) {
 	print(filepath << "\n\n");
+	if (IsMeshFile(filepath)) return LoadMesh(filepath);
+
+	Timer timer;
+	MappedFile source(filepath);
+	if (!source.IsOpen()) { print("ERROR: OBJLoader got a NULL directory"); return false; }
+
+	// Small files aren't worth waking the threads for
+	std::unique_ptr<ThreadPool> pool = source.GetSize() > ParseChunkSize ? std::make_unique<ThreadPool>(threadsCount) : nullptr;
+
+	std::vector<glm::ivec3> corners;
+	ParseMapped((const char*)source.GetData(), (const char*)source.GetData() + source.GetSize(), corners, pool.get());
+	print("OBJ: parsed " << source.GetSize() / 1e6 << " MB in " << timer.GetMilliseconds() << " ms, " << source.GetSize() / 1e6 / timer.GetSeconds() << " MB/s, " <<
+		(pool ? pool->GetThreadsCount() : 1) << " threads");
+
+	if (vertexArray) CreateVertexArray(corners);
+	CreateSSBuffer(corners);
+	LoadMaterials(filepath);
+
+	if (this->ssbVData.indicesCount == 0) { print("ERROR: No triangles in " << filepath); return false; }
+	return true;
+}
+
+// Mapped parsing: scans the text in place, numbers go through from_chars and nothing gets copied per line or token.
+// Files bigger than a chunk are split at line ends and parsed by every core in three passes over the chunks:
+// counting their v/vt/vn lines and triangles, whose prefix sums place each chunk output in the shared arrays,
+// then parsing the values and face indices straight into those arrays. The o/g, mtllib and usemtl lines are placed in the counting pass
+
+namespace {
+	inline const char* SkipSpaces(const char* p, const char* end) {
+		while (p < end && (*p == ' ' || *p == '\t')) p++;
+		return p;
+	}
+
+	inline const char* ParseFloat(const char* p, const char* end, float& value) {
+		p = SkipSpaces(p, end);
+		if (p < end && *p == '+') p++;
+		return std::from_chars(p, end, value).ptr;
+	}
+
+	// OBJ indices are 1 based, negative ones count back from the last element read so far. 0 means missing
+	inline int ResolveIndex(int index, int count) {
+		return index > 0 ? index - 1 : (index < 0 ? count + index : -1);
+	}
+
+	enum class LineType { OTHER, POSITION, TEXTURE_COORD, NORMAL, FACE, GROUP, MATERIAL_LIBRARY, USE_MATERIAL };
+
+	// Whether the line starts with the keyword followed by a space
+	inline bool IsKeyword(const char* p, const char* lineEnd, const char* keyword) {
+		const size_t length = std::strlen(keyword);
+		return (size_t)(lineEnd - p) > length && std::memcmp(p, keyword, length) == 0 && (p[length] == ' ' || p[length] == '\t');
+	}
+
+	// The rest of the line without the surrounding spaces, names and paths may have spaces inside
+	inline std::string ReadName(const char* p, const char* lineEnd) {
+		p = SkipSpaces(p, lineEnd);
+		while (lineEnd > p && (lineEnd[-1] == ' ' || lineEnd[-1] == '\t' || lineEnd[-1] == '\r')) lineEnd--;
+		return std::string(p, lineEnd);
+	}
+
+	// Calls lineFunction(type, values start, line end) for every line in [begin, end)
+	template <typename F>
+	void ForEachLine(const char* begin, const char* end, F lineFunction) {
+		for (const char* line = begin; line < end;) {
+			const char* lineEnd = (const char*)std::memchr(line, '\n', end - line);
+			if (!lineEnd) lineEnd = end;
+			const char* p = SkipSpaces(line, lineEnd);
+			line = lineEnd + 1;
+
+			if (lineEnd - p < 2) continue;
+
+			LineType type = LineType::OTHER;
+			const char* values = p + 2;
+			if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) type = LineType::POSITION;
+			else if (p[0] == 'v' && p[1] == 't') type = LineType::TEXTURE_COORD;
+			else if (p[0] == 'v' && p[1] == 'n') type = LineType::NORMAL;
+			else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) type = LineType::FACE;
+			else if ((p[0] == 'o' || p[0] == 'g') && (p[1] == ' ' || p[1] == '\t')) type = LineType::GROUP;
+			else if (IsKeyword(p, lineEnd, "mtllib")) { type = LineType::MATERIAL_LIBRARY; values = p + 7; }
+			else if (IsKeyword(p, lineEnd, "usemtl")) { type = LineType::USE_MATERIAL; values = p + 7; }
+
+			if (type != LineType::OTHER) lineFunction(type, values, lineEnd);
+		}
+	}
+
+	// Calls cornerFunction(v, vt, vn) with the raw indices of every corner of a face: f v, f v/vt, f v//vn or f v/vt/vn
+	template <typename F>
+	void ForEachCorner(const char* p, const char* lineEnd, F cornerFunction) {
+		while (true) {
+			p = SkipSpaces(p, lineEnd);
+			if (p >= lineEnd || *p == '\r' || *p == '#') return;
+
+			int indices[3] = { 0, 0, 0 };
+			for (int i = 0; i < 3; i++) {
+				if (p < lineEnd && *p != '/') p = std::from_chars(p, lineEnd, indices[i]).ptr;
+				if (p >= lineEnd || *p != '/') break;
+				p++;
+			}
+			while (p < lineEnd && *p != ' ' && *p != '\t' && *p != '\r') p++;
+
+			cornerFunction(indices[0], indices[1], indices[2]);
+		}
+	}
+
+	template <typename T>
+	inline T ValueAt(const std::vector<T>& values, int index) {
+		return index >= 0 && index < values.size() ? values[index] : T(0.0f);
+	}
+}
+
+void OBJLoader::ParseMapped(const char* data, const char* end, std::vector<glm::ivec3>& corners, ThreadPool* pool) {
+	// Chunks start right after a line end
+	std::vector<const char*> chunkStarts = std::vector<const char*>(1, data);
+	if (pool) {
+		for (const char* p = data + ParseChunkSize; p < end; p += ParseChunkSize) {
+			const char* lineEnd = (const char*)std::memchr(p, '\n', end - p);
+			if (!lineEnd || lineEnd + 1 >= end) break;
+			p = lineEnd + 1;
+			chunkStarts.push_back(p);
+		}
+	}
+	chunkStarts.push_back(end);
+	const int chunksCount = (int)chunkStarts.size() - 1;
+
+	auto forEachChunk = [&](const std::function<void(int)>& chunkFunction) {
+		if (!pool || chunksCount == 1) { for (int c = 0; c < chunksCount; c++) chunkFunction(c); return; }
+
+		TaskGroup group;
+		for (int c = 0; c < chunksCount; c++) pool->Submit(group, [&chunkFunction, c]() { chunkFunction(c); });
+		pool->Wait(group);
+	};
+
+	// Counts, prefix summed into each chunk first position, uv, normal and triangle.
+	// Groups and material uses start at the triangle count of their line, chunk relative until the prefix sums
+	std::vector<ParseCounts> bases = std::vector<ParseCounts>(chunksCount + 1);
+	std::vector<std::vector<int>> chunkGroups = std::vector<std::vector<int>>(chunksCount);
+	std::vector<std::vector<MaterialUse>> chunkMaterialUses = std::vector<std::vector<MaterialUse>>(chunksCount);
+	std::vector<std::vector<std::string>> chunkLibraries = std::vector<std::vector<std::string>>(chunksCount);
+	forEachChunk([&](int c) {
+		ParseCounts& counts = bases[c + 1];
+		ForEachLine(chunkStarts[c], chunkStarts[c + 1], [&](LineType type, const char* p, const char* lineEnd) {
+			if (type == LineType::POSITION) counts.positions++;
+			else if (type == LineType::TEXTURE_COORD) counts.textureCoords++;
+			else if (type == LineType::NORMAL) counts.normals++;
+			else if (type == LineType::GROUP) chunkGroups[c].push_back(counts.triangles);
+			else if (type == LineType::MATERIAL_LIBRARY) chunkLibraries[c].push_back(ReadName(p, lineEnd));
+			else if (type == LineType::USE_MATERIAL) chunkMaterialUses[c].push_back({ counts.triangles, ReadName(p, lineEnd) });
+			else {
+				int corners = 0;
+				ForEachCorner(p, lineEnd, [&](int, int, int) { corners++; });
+				counts.triangles += std::max(0, corners - 2);
+			}
+		});
+	});
+
+	for (int c = 0; c < chunksCount; c++) {
+		bases[c + 1].positions += bases[c].positions;
+		bases[c + 1].textureCoords += bases[c].textureCoords;
+		bases[c + 1].normals += bases[c].normals;
+		bases[c + 1].triangles += bases[c].triangles;
+	}
+	const ParseCounts& totals = bases[chunksCount];
+
+	this->positions.resize(totals.positions);
+	this->textureCoords.resize(totals.textureCoords);
+	this->normals.resize(totals.normals);
+	corners.resize(totals.triangles * 3);
+
+	// Groups without faces (like an o line followed by a g line) are dropped
+	this->subMeshes.clear();
+	int groupStart = 0;
+	auto closeGroup = [&](int groupEnd) {
+		if (groupEnd == groupStart) return;
+		SubMesh subMesh = SubMesh();
+		subMesh.indicesStart = groupStart * 3;
+		subMesh.indicesCount = (groupEnd - groupStart) * 3;
+		this->subMeshes.push_back(subMesh);
+		groupStart = groupEnd;
+	};
+	for (int c = 0; c < chunksCount; c++)
+		for (int start : chunkGroups[c]) closeGroup(bases[c].triangles + start);
+	closeGroup(totals.triangles);
+
+	this->materialLibraries.clear();
+	this->materialUses.clear();
+	for (int c = 0; c < chunksCount; c++) {
+		this->materialLibraries.insert(this->materialLibraries.end(), chunkLibraries[c].begin(), chunkLibraries[c].end());
+		for (MaterialUse& use : chunkMaterialUses[c]) this->materialUses.push_back({ bases[c].triangles + use.triangle, std::move(use.name) });
+	}
+
+	forEachChunk([&](int c) {
+		ParseCounts read = bases[c];
+		std::vector<glm::ivec3> polygon = std::vector<glm::ivec3>();
+
+		ForEachLine(chunkStarts[c], chunkStarts[c + 1], [&](LineType type, const char* p, const char* lineEnd) {
+			if (type == LineType::GROUP || type == LineType::MATERIAL_LIBRARY || type == LineType::USE_MATERIAL) return;
+			if (type != LineType::FACE) {
+				glm::vec3 value = glm::vec3(0);
+				p = ParseFloat(p, lineEnd, value.x);
+				p = ParseFloat(p, lineEnd, value.y);
+				ParseFloat(p, lineEnd, value.z);
+
+				if (type == LineType::POSITION) this->positions[read.positions++] = value;
+				else if (type == LineType::TEXTURE_COORD) this->textureCoords[read.textureCoords++] = glm::vec2(value);
+				else this->normals[read.normals++] = value;
+				return;
+			}
+
+			polygon.clear();
+			ForEachCorner(p, lineEnd, [&](int v, int vt, int vn) {
+				polygon.push_back(glm::ivec3(ResolveIndex(v, read.positions), ResolveIndex(vt, read.textureCoords), ResolveIndex(vn, read.normals)));
+			});
+
+			// Polygons get fanned into triangles
+			for (int i = 2; i < polygon.size(); i++) {
+				glm::ivec3* triangle = &corners[read.triangles++ * 3];
+				triangle[0] = polygon[0];
+				triangle[1] = polygon[i - 1];
+				triangle[2] = polygon[i];
+			}
+		});
+	});
+}
 
-	if (!stream) { print("ERROR: OBJLoader got a NULL directory"); return; }
+Vertex OBJLoader::CornerVertex(const glm::ivec3& corner) const {
+	Vertex vertex = Vertex();
+	vertex.position = ValueAt(this->positions, corner.x);
+	vertex.textureCoord = ValueAt(this->textureCoords, corner.y);
+	vertex.normal = ValueAt(this->normals, corner.z);
+	return vertex;
+}
 
-	std::vector<Vertex> objVertices;
+// The getline parser the mapped one replaced, still around to compare them with CompareParsers
+void OBJLoader::ParseLines(const char* filepath, std::vector<Vertex>& objVertices) {
+	std::ifstream stream = std::ifstream(filepath);
 	std::string line;
 
 	while (getline(stream, line)) {
@@ -42,9 +294,45 @@ OBJLoader::OBJLoader(const char* filepath) {
 			continue;
 		}
 	}
+}
+
+void OBJLoader::CompareParsers(const char* filepath) {
+	MappedFile source(filepath);
+	if (!source.IsOpen()) { print("ERROR: OBJLoader got a NULL directory"); return; }
+	const double megabytes = source.GetSize() / 1e6;
+
+	OBJLoader lines;
+	std::vector<Vertex> lineVertices;
+	Timer timer;
+	lines.ParseLines(filepath, lineVertices);
+	const double linesSeconds = timer.GetSeconds();
+
+	OBJLoader mapped;
+	std::vector<glm::ivec3> mappedCorners;
+	timer.Reset();
+	mapped.ParseMapped((const char*)source.GetData(), (const char*)source.GetData() + source.GetSize(), mappedCorners);
+	const double mappedSeconds = timer.GetSeconds();
+
+	ThreadPool pool;
+	OBJLoader parallel;
+	std::vector<glm::ivec3> parallelCorners;
+	timer.Reset();
+	parallel.ParseMapped((const char*)source.GetData(), (const char*)source.GetData() + source.GetSize(), parallelCorners, &pool);
+	const double parallelSeconds = timer.GetSeconds();
+
+	auto sameVertices = [&](const OBJLoader& loader, const std::vector<glm::ivec3>& corners) {
+		if (corners.size() != lineVertices.size()) return false;
+		for (int i = 0; i < corners.size(); i++) {
+			Vertex vertex = loader.CornerVertex(corners[i]);
+			if (vertex.position != lineVertices[i].position || vertex.textureCoord != lineVertices[i].textureCoord ||
+				vertex.normal != lineVertices[i].normal) return false;
+		}
+		return true;
+	};
 
-	CreateVertexArray(objVertices);
-	CreateSSBuffer(objVertices);
+	print("OBJ parsers on " << megabytes << " MB: getline " << megabytes / linesSeconds << " MB/s, mapped " << megabytes / mappedSeconds << " MB/s (" <<
+		linesSeconds / mappedSeconds << "x), mapped on " << pool.GetThreadsCount() << " threads " << megabytes / parallelSeconds << " MB/s (" <<
+		linesSeconds / parallelSeconds << "x), " << (sameVertices(mapped, mappedCorners) && sameVertices(parallel, parallelCorners) ? "same" : "DIFFERENT") << " vertices");
 }
 
 // v, vt, vn
@@ -98,7 +386,10 @@ Vertex OBJLoader::CreateVertex(const std::string& indicies) {
 }
 
 
-void OBJLoader::CreateVertexArray(const std::vector<Vertex>& loadedVertices) {
+void OBJLoader::CreateVertexArray(const std::vector<glm::ivec3>& corners) {
+	std::vector<Vertex> loadedVertices = std::vector<Vertex>(corners.size());
+	for (int i = 0; i < corners.size(); i++) loadedVertices[i] = CornerVertex(corners[i]);
+
 	uint32_t arrSize = Vertex::GetStride() * loadedVertices.size();
 	this->vData.vertices = new float[arrSize];
 	this->vData.verticesSize = arrSize;
@@ -140,31 +431,576 @@ void OBJLoader::CreateVertexArray(const std::vector<Vertex>& loadedVertices) {
 
 }
 
-void OBJLoader::CreateSSBuffer(const std::vector<Vertex>& loadedVertices) {
+void OBJLoader::CreateSSBuffer(const std::vector<glm::ivec3>& corners) {
+	// Every distinct v/vt/vn triplet becomes one vertex, the triangle corners index them
+	struct CornerHash {
+		size_t operator()(const glm::ivec3& corner) const {
+			return (size_t)corner.x * 73856093u ^ (size_t)corner.y * 19349663u ^ (size_t)corner.z * 83492791u;
+		}
+	};
+	std::unordered_map<glm::ivec3, unsigned int, CornerHash> vertexOf = std::unordered_map<glm::ivec3, unsigned int, CornerHash>();
+	vertexOf.reserve(corners.size());
+
+	// Only the corner of each unique vertex is kept, the vertices get written straight into the SSBuffer once they're counted
+	std::vector<glm::ivec3> uniqueCorners = std::vector<glm::ivec3>();
+	this->ssbVData.indices = new unsigned int[corners.size()];
+	this->ssbVData.indicesCount = (int)corners.size();
+	for (int i = 0; i < corners.size(); i++) {
+		auto inserted = vertexOf.emplace(corners[i], (unsigned int)uniqueCorners.size());
+		if (inserted.second) uniqueCorners.push_back(corners[i]);
+		this->ssbVData.indices[i] = inserted.first->second;
+	}
+
 	// SSBData
-	constexpr uint32_t fill = 4;
-	const uint32_t filledStride = Vertex::GetStride() + fill;
-	uint32_t arrSize = filledStride * loadedVertices.size();
+	const uint32_t filledStride = Vertex::GetSSBStride();
+	uint32_t arrSize = filledStride * uniqueCorners.size();
 	this->ssbVData.vertices = new float[arrSize];
 	this->ssbVData.verticesSize = arrSize;
-	this->ssbVData.verticesCount = loadedVertices.size();
-	const std::vector<Vertex>& lv = loadedVertices;
+	this->ssbVData.verticesCount = uniqueCorners.size();
 
 	float* vertices = (this->ssbVData.vertices);
-	for (int i = 0, k = 0; k < lv.size(); i += filledStride, k++) {
-		*(vertices + i + 0) = lv.at(k).position.x;
-		*(vertices + i + 1) = lv.at(k).position.y;
-		*(vertices + i + 2) = lv.at(k).position.z;
+	for (int i = 0, k = 0; k < uniqueCorners.size(); i += filledStride, k++) {
+		const Vertex vertex = CornerVertex(uniqueCorners[k]);
+		*(vertices + i + 0) = vertex.position.x;
+		*(vertices + i + 1) = vertex.position.y;
+		*(vertices + i + 2) = vertex.position.z;
 		*(vertices + i + 3) = 0.0f;
 
-		*(vertices + i + 4) = lv.at(k).textureCoord.x;
-		*(vertices + i + 5) = lv.at(k).textureCoord.y;
+		*(vertices + i + 4) = vertex.textureCoord.x;
+		*(vertices + i + 5) = vertex.textureCoord.y;
 		*(vertices + i + 6) = 0.0f;
 		*(vertices + i + 7) = 0.0f;
 
-		*(vertices + i + 8)  = lv.at(k).normal.x;
-		*(vertices + i + 9)  = lv.at(k).normal.y;
-		*(vertices + i + 10) = lv.at(k).normal.z;
+		*(vertices + i + 8)  = vertex.normal.x;
+		*(vertices + i + 9)  = vertex.normal.y;
+		*(vertices + i + 10) = vertex.normal.z;
 		*(vertices + i + 11) = 0.0f;
 	}
-}
\ No newline at end of file
+
+	PrintSSBufferMemory();
+}
+
+void OBJLoader::PrintSSBufferMemory() const {
+	const int vertexBytes = Vertex::GetSSBStride() * sizeof(float);
+	const float indexedKB = (this->ssbVData.verticesCount * vertexBytes + this->ssbVData.indicesCount * sizeof(unsigned int)) / 1024.0f;
+	const float expandedKB = this->ssbVData.indicesCount * vertexBytes / 1024.0f;
+
+	print("Mesh SSBuffer: " << this->ssbVData.verticesCount << " unique vertices for " << this->ssbVData.indicesCount << " corners, " <<
+		indexedKB << " KB with indices instead of " << expandedKB << " KB (" << expandedKB / indexedKB << "x less)");
+}
+
+// Materials
+
+namespace {
+	// r [g b], a single value is a grey
+	inline glm::vec3 ParseColor(const char* p, const char* end) {
+		glm::vec3 color = glm::vec3(0.0f);
+		p = ParseFloat(p, end, color.r);
+		color.g = color.b = color.r;
+		p = ParseFloat(p, end, color.g);
+		ParseFloat(p, end, color.b);
+		return color;
+	}
+
+	// Appends the newmtl blocks of an MTL library, mapping them to the pathtracer materials:
+	// Kd and d are the albedo, the rest of d transmits, Ks the specular chance, Ns (0 - 1000) the roughness, Ni the IOR and Ke the emission
+	void ParseMaterialLibrary(const char* data, const char* end, const std::string& directory, std::vector<std::string>& names, std::vector<MeshMaterial>& materials) {
+		MeshMaterial* current = nullptr;
+		for (const char* line = data; line < end;) {
+			const char* lineEnd = (const char*)std::memchr(line, '\n', end - line);
+			if (!lineEnd) lineEnd = end;
+			const char* p = SkipSpaces(line, lineEnd);
+			line = lineEnd + 1;
+
+			if (IsKeyword(p, lineEnd, "newmtl")) {
+				names.push_back(ReadName(p + 7, lineEnd));
+				materials.push_back(MeshMaterial());
+				current = &materials.back();
+				continue;
+			}
+			if (!current) continue;
+
+			Material& material = current->material;
+			float value = 0.0f;
+			if (IsKeyword(p, lineEnd, "Kd")) material.albedo = glm::vec4(ParseColor(p + 3, lineEnd), material.albedo.a);
+			else if (IsKeyword(p, lineEnd, "Ks")) {
+				glm::vec3 specular = ParseColor(p + 3, lineEnd);
+				material.specular = std::max(specular.r, std::max(specular.g, specular.b));
+			}
+			else if (IsKeyword(p, lineEnd, "Ns")) {
+				ParseFloat(p + 3, lineEnd, value);
+				material.roughness = 1.0f - std::sqrt(glm::clamp(value / 1000.0f, 0.0f, 1.0f));
+			}
+			else if (IsKeyword(p, lineEnd, "Ni")) ParseFloat(p + 3, lineEnd, material.IOR);
+			else if (IsKeyword(p, lineEnd, "d") || IsKeyword(p, lineEnd, "Tr")) {
+				ParseFloat(p + (p[0] == 'd' ? 2 : 3), lineEnd, value);
+				material.albedo.a = p[0] == 'd' ? value : 1.0f - value;
+				material.transmission = 1.0f - material.albedo.a;
+			}
+			else if (IsKeyword(p, lineEnd, "Ke")) {
+				glm::vec3 emission = ParseColor(p + 3, lineEnd);
+				material.emissivePower = std::max(emission.r, std::max(emission.g, emission.b));
+				material.emissiveColor = material.emissivePower > 0.0f ? emission / material.emissivePower : glm::vec3(0.0f);
+			}
+			else if (IsKeyword(p, lineEnd, "map_Kd")) {
+				// Options like -s come before the file, which is the last token
+				std::string path = ReadName(p + 7, lineEnd);
+				path = directory + path.substr(path.find_last_of(" \t") + 1);
+				if (path.size() < sizeof(current->texturePath)) std::memcpy(current->texturePath, path.c_str(), path.size() + 1);
+				else print("WARNING: Skipped the texture " << path << ", the path is too long");
+			}
+		}
+	}
+}
+
+void OBJLoader::LoadMaterials(const char* filepath) {
+	const int trianglesCount = this->ssbVData.indicesCount / 3;
+	const std::string source = filepath;
+	const std::string directory = source.substr(0, source.find_last_of("/\\") + 1);
+
+	this->materials.clear();
+	std::vector<std::string> names = std::vector<std::string>();
+	for (const std::string& library : this->materialLibraries) {
+		MappedFile file((directory + library).c_str());
+		if (!file.IsOpen()) { print("WARNING: Couldn't open the material library " << directory + library << ", its materials fall back to the mesh material"); continue; }
+		ParseMaterialLibrary((const char*)file.GetData(), (const char*)file.GetData() + file.GetSize(), directory, names, this->materials);
+	}
+
+	// The first library defining a name wins
+	std::unordered_map<std::string, unsigned int> materialOf = std::unordered_map<std::string, unsigned int>();
+	for (int m = 0; m < names.size(); m++) materialOf.emplace(names[m], m + 1);
+
+	this->ssbVData.triangleMaterials = new unsigned int[trianglesCount];
+	int useStart = 0;
+	unsigned int useMaterial = 0;
+	for (int u = 0; u <= this->materialUses.size(); u++) {
+		const int useEnd = u < this->materialUses.size() ? std::min(this->materialUses[u].triangle, trianglesCount) : trianglesCount;
+		std::fill(this->ssbVData.triangleMaterials + useStart, this->ssbVData.triangleMaterials + useEnd, useMaterial);
+		if (u == this->materialUses.size()) break;
+
+		auto found = materialOf.find(this->materialUses[u].name);
+		useMaterial = found != materialOf.end() ? found->second : 0;
+		useStart = useEnd;
+	}
+
+	if (!this->materials.empty()) print("Materials: " << this->materials.size() << " from " << this->materialLibraries.size() << " libraries, " << this->materialUses.size() << " usemtl lines");
+	this->materialLibraries.clear();
+	this->materialUses.clear();
+}
+
+void OBJLoader::CreateTriangles(int first, int count, TriangleData* triangles) const {
+	const int stride = Vertex::GetSSBStride();
+	const float* vertices = this->ssbVData.vertices;
+	const unsigned int* indices = this->ssbVData.indices;
+
+	for (int t = first; t < first + count; t++) {
+		const float* p0 = vertices + indices[t * 3 + 0] * stride;
+		const float* p1 = vertices + indices[t * 3 + 1] * stride;
+		const float* p2 = vertices + indices[t * 3 + 2] * stride;
+
+		glm::vec3 v0 = glm::vec3(p0[0], p0[1], p0[2]);
+		glm::vec3 edge1 = glm::vec3(p1[0], p1[1], p1[2]) - v0;
+		glm::vec3 edge2 = glm::vec3(p2[0], p2[1], p2[2]) - v0;
+		glm::vec3 normal = glm::cross(edge1, edge2);
+
+		triangles[t - first] = { glm::vec4(v0, normal.x), glm::vec4(edge1, normal.y), glm::vec4(edge2, normal.z) };
+	}
+}
+
+namespace {
+	// Unit vector folded onto the octahedron |x| + |y| + |z| = 1, whose lower half gets unfolded over the corners of the square
+	glm::vec2 OctahedralEncode(const glm::vec3& normal) {
+		const float length = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+		if (length == 0.0f) return glm::vec2(0.0f);
+
+		glm::vec2 encoded = glm::vec2(normal) / length;
+		if (normal.z < 0.0f) {
+			glm::vec2 folded = 1.0f - glm::abs(glm::vec2(encoded.y, encoded.x));
+			encoded = glm::vec2(encoded.x >= 0.0f ? folded.x : -folded.x, encoded.y >= 0.0f ? folded.y : -folded.y);
+		}
+		return encoded;
+	}
+}
+
+void OBJLoader::CreateCompactVertices(int first, int count, CompactVertex* compactVertices) const {
+	const int stride = Vertex::GetSSBStride();
+	for (int v = first; v < first + count; v++) {
+		const float* vertex = this->ssbVData.vertices + v * stride;
+		CompactVertex& compact = compactVertices[v - first];
+		compact.position[0] = vertex[0];
+		compact.position[1] = vertex[1];
+		compact.position[2] = vertex[2];
+		compact.uv = glm::packHalf2x16(glm::vec2(vertex[4], vertex[5]));
+		compact.normal = glm::packSnorm2x16(OctahedralEncode(glm::vec3(vertex[8], vertex[9], vertex[10])));
+	}
+}
+
+void OBJLoader::BuildBVH(const BVHSettings& settings) {
+	const int stride = Vertex::GetSSBStride();
+	const float* vertices = this->ssbVData.vertices;
+	const unsigned int* indices = this->ssbVData.indices;
+
+	ThreadPool pool(settings.threadsCount);
+	this->builtNodes.clear();
+	this->bvhNodeBytes = settings.width <= 2 ? sizeof(BVHNode) : WideBVH::NodeUints(settings.width) * sizeof(unsigned int);
+	std::vector<unsigned int> reordered = std::vector<unsigned int>();
+	std::vector<unsigned int> reorderedMaterials = std::vector<unsigned int>();
+	reordered.reserve(this->ssbVData.indicesCount);
+	reorderedMaterials.reserve(this->ssbVData.indicesCount / 3);
+
+	std::vector<SubMesh> builtSubMeshes = std::vector<SubMesh>();
+	for (int g = 0; g < this->subMeshes.size(); g++) {
+		const SubMesh& group = this->subMeshes[g];
+		const unsigned int* groupIndices = indices + group.indicesStart;
+		const unsigned int* groupMaterials = this->ssbVData.triangleMaterials + group.indicesStart / 3;
+		if (this->subMeshes.size() > 1) print("Group " << g << ":");
+
+		// Triangles of the group (in its indices order) per BVH, a group too big for one wide BVH gets split in more parts
+		std::vector<std::vector<unsigned int>> parts = { std::vector<unsigned int>(group.indicesCount / 3) };
+		for (unsigned int t = 0; t < parts[0].size(); t++) parts[0][t] = t;
+
+		while (!parts.empty()) {
+			const std::vector<unsigned int> part = std::move(parts.back());
+			parts.pop_back();
+			const int trianglesCount = (int)part.size();
+
+			std::vector<glm::vec3> triangles = std::vector<glm::vec3>(trianglesCount * 3);
+			std::vector<AABB> trianglesBounds = std::vector<AABB>(trianglesCount);
+			for (int t = 0; t < trianglesCount; t++) {
+				for (int v = 0; v < 3; v++) {
+					const float* position = vertices + groupIndices[part[t] * 3 + v] * stride;
+					triangles[t * 3 + v] = glm::vec3(position[0], position[1], position[2]);
+					trianglesBounds[t].Grow(triangles[t * 3 + v]);
+				}
+			}
+
+			if (settings.spatialSplits) this->bvh.BuildSpatial(triangles, settings.overlapBudget);
+			else this->bvh.Build(trianglesBounds, &pool);
+
+			print("BVH: " << this->bvh.GetNodesCount() << " nodes over " << trianglesCount << " triangles, SAH cost " << this->bvh.SAHCost() << ", " << pool.GetThreadsCount() << " threads");
+
+			if (settings.spatialSplits) {
+				// Compared against the plain binned SAH build on the same rays
+				BVH binned = BVH();
+				binned.Build(trianglesBounds, &pool);
+				TraversalStats spatialStats = this->bvh.MeasureTraversal(triangles);
+				TraversalStats binnedStats = binned.MeasureTraversal(triangles);
+
+				print("SBVH: " << this->bvh.GetNodesCount() << " nodes, " << this->bvh.GetPrimIndices().size() << " triangle references, " <<
+					spatialStats.costPerRay << " cost per ray (" << spatialStats.nodesPerRay << " nodes, " << spatialStats.trianglesPerRay << " triangles)");
+				print("Binned SAH: " << binned.GetNodesCount() << " nodes, " << binned.GetPrimIndices().size() << " triangle references, " <<
+					binnedStats.costPerRay << " cost per ray (" << binnedStats.nodesPerRay << " nodes, " << binnedStats.trianglesPerRay << " triangles)");
+			}
+
+			// Leaves reference contiguous triangle ranges, so lay the part triangles out in the BVH order
+			std::vector<unsigned int> order = this->bvh.GetPrimIndices();
+			const unsigned int* nodes = (const unsigned int*)this->bvh.GetNodes().data();
+			size_t nodesBytes = this->bvh.GetNodesCount() * sizeof(BVHNode);
+
+			if (settings.width <= 2) print("BVH: " << (float)nodesBytes / trianglesCount << " node bytes per triangle");
+			else {
+				// The wide leaves pack the triangles of a node together, in their own order over the BVH order
+				this->wideBVH = WideBVH(settings.width);
+				if (!this->wideBVH.Collapse(this->bvh)) {
+					// Split at the centroids median along the widest axis, each half gets its own BVH
+					print("Wide BVH: splitting the group");
+					AABB centroidsBounds = AABB();
+					for (const AABB& bounds : trianglesBounds) centroidsBounds.Grow(bounds.Center());
+					const glm::vec3 extent = centroidsBounds.max - centroidsBounds.min;
+					const int axis = extent.x > extent.y && extent.x > extent.z ? 0 : (extent.y > extent.z ? 1 : 2);
+
+					std::vector<unsigned int> sorted = std::vector<unsigned int>(trianglesCount);
+					for (int t = 0; t < trianglesCount; t++) sorted[t] = t;
+					std::nth_element(sorted.begin(), sorted.begin() + trianglesCount / 2, sorted.end(),
+						[&](unsigned int a, unsigned int b) { return trianglesBounds[a].Center()[axis] < trianglesBounds[b].Center()[axis]; });
+
+					std::vector<unsigned int> lower = std::vector<unsigned int>(), upper = std::vector<unsigned int>();
+					for (int t = 0; t < trianglesCount; t++) (t < trianglesCount / 2 ? lower : upper).push_back(part[sorted[t]]);
+					parts.push_back(std::move(upper));
+					parts.push_back(std::move(lower));
+					continue;
+				}
+
+				const std::vector<unsigned int>& wideOrder = this->wideBVH.GetPrimIndices();
+				std::vector<unsigned int> binaryOrder = order;
+				order.resize(wideOrder.size());
+				for (int t = 0; t < wideOrder.size(); t++) order[t] = binaryOrder[wideOrder[t]];
+
+				nodes = this->wideBVH.GetNodes().data();
+				nodesBytes = this->wideBVH.GetNodesCount() * this->wideBVH.GetNodeBytes();
+				print("Wide BVH (" << settings.width << "): " << this->wideBVH.GetNodesCount() << " nodes, " << (float)nodesBytes / trianglesCount << " node bytes per triangle");
+			}
+
+			// Only the indices and triangle materials move, the order may repeat triangles and the part takes its size
+			SubMesh subMesh = SubMesh();
+			subMesh.indicesStart = (int)reordered.size();
+			subMesh.indicesCount = (int)order.size() * 3;
+			subMesh.bvhRoot = (int)(this->builtNodes.size() * sizeof(unsigned int) / this->bvhNodeBytes);
+			subMesh.bounds = this->bvh.GetBounds();
+			for (unsigned int t : order) {
+				const unsigned int triangle = part[t];
+				reordered.insert(reordered.end(), groupIndices + triangle * 3, groupIndices + (triangle + 1) * 3);
+				reorderedMaterials.push_back(groupMaterials[triangle]);
+			}
+			this->builtNodes.insert(this->builtNodes.end(), nodes, nodes + nodesBytes / sizeof(unsigned int));
+			builtSubMeshes.push_back(subMesh);
+		}
+	}
+	this->subMeshes = builtSubMeshes;
+
+	if (!IsMapped(this->ssbVData.indices)) delete[] this->ssbVData.indices;
+	this->ssbVData.indices = new unsigned int[reordered.size()];
+	this->ssbVData.indicesCount = (int)reordered.size();
+	std::copy(reordered.begin(), reordered.end(), this->ssbVData.indices);
+
+	if (!IsMapped(this->ssbVData.triangleMaterials)) delete[] this->ssbVData.triangleMaterials;
+	this->ssbVData.triangleMaterials = new unsigned int[reorderedMaterials.size()];
+	std::copy(reorderedMaterials.begin(), reorderedMaterials.end(), this->ssbVData.triangleMaterials);
+
+	this->bvhNodes = this->builtNodes.data();
+	this->bvhNodesSize = this->builtNodes.size() * sizeof(unsigned int);
+}
+
+// BVH cache
+
+uint64_t OBJLoader::HashSource(const char* filepath) {
+	// FNV-1a over the whole OBJ
+	MappedFile source(filepath);
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < source.GetSize(); i++) {
+		hash ^= source.GetData()[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+uint64_t OBJLoader::SourceKey(const char* filepath) {
+	// The binary mesh is as big as the OBJ, and its header already has the OBJ hash
+	if (IsMeshFile(filepath)) {
+		MappedFile file(filepath);
+		const MeshHeader* header = (const MeshHeader*)file.GetData();
+		if (file.IsOpen() && file.GetSize() >= sizeof(MeshHeader) && std::memcmp(header->magic, "PTMS", 4) == 0)
+			return (header->sourceHash ^ header->version) * 1099511628211ull;
+	}
+	return HashSource(filepath);
+}
+
+std::string OBJLoader::CachePath(const char* filepath, const BVHSettings& settings) {
+	return std::string(filepath) + (settings.spatialSplits ? ".sbvh" : ".bvh") + std::to_string(settings.width) + ".cache";
+}
+
+bool OBJLoader::LoadCache(const char* filepath, const BVHSettings& settings, uint64_t sourceHash) {
+	MappedFile* file = new MappedFile(CachePath(filepath, settings).c_str());
+
+	const CacheHeader* header = (const CacheHeader*)file->GetData();
+	bool valid = file->IsOpen() && file->GetSize() >= sizeof(CacheHeader) &&
+		std::memcmp(header->magic, "PTBC", 4) == 0 && header->version == CacheVersion &&
+		header->sourceHash == sourceHash && header->bvhWidth == settings.width &&
+		header->spatialSplits == (int32_t)settings.spatialSplits && (!settings.spatialSplits || header->overlapBudget == settings.overlapBudget) &&
+		header->verticesOffset + header->verticesSize * sizeof(float) <= file->GetSize() &&
+		header->indicesOffset + header->indicesCount * sizeof(unsigned int) <= file->GetSize() &&
+		header->nodesOffset + header->nodesSize <= file->GetSize() &&
+		header->subMeshesOffset + header->subMeshesCount * sizeof(SubMesh) <= file->GetSize() &&
+		header->triangleMaterialsOffset + header->indicesCount / 3 * sizeof(unsigned int) <= file->GetSize() &&
+		header->materialsOffset + header->materialsCount * sizeof(MeshMaterial) <= file->GetSize();
+
+	if (!valid) { delete file; return false; }
+
+	this->cache = file;
+	this->ssbVData.vertices = (float*)(file->GetData() + header->verticesOffset); // Read only, straight to SSBO::SendData
+	this->ssbVData.verticesSize = header->verticesSize;
+	this->ssbVData.verticesCount = header->verticesCount;
+	this->ssbVData.indices = (unsigned int*)(file->GetData() + header->indicesOffset);
+	this->ssbVData.indicesCount = header->indicesCount;
+	this->ssbVData.triangleMaterials = (unsigned int*)(file->GetData() + header->triangleMaterialsOffset);
+	PrintSSBufferMemory();
+
+	this->bvhNodes = file->GetData() + header->nodesOffset;
+	this->bvhNodesSize = (size_t)header->nodesSize;
+	this->bvhNodeBytes = header->nodeBytes;
+	const SubMesh* subMeshes = (const SubMesh*)(file->GetData() + header->subMeshesOffset);
+	this->subMeshes.assign(subMeshes, subMeshes + header->subMeshesCount);
+	const MeshMaterial* materials = (const MeshMaterial*)(file->GetData() + header->materialsOffset);
+	this->materials.assign(materials, materials + header->materialsCount);
+
+	print("BVH: loaded from cache " << CachePath(filepath, settings));
+	return true;
+}
+
+void OBJLoader::SaveCache(const char* filepath, const BVHSettings& settings, uint64_t sourceHash) const {
+	const uint64_t verticesBytes = this->ssbVData.verticesSize * sizeof(float);
+	const uint64_t indicesBytes = this->ssbVData.indicesCount * sizeof(unsigned int);
+	const uint64_t subMeshesBytes = this->subMeshes.size() * sizeof(SubMesh);
+	const uint64_t triangleMaterialsBytes = this->ssbVData.indicesCount / 3 * sizeof(unsigned int);
+
+	CacheHeader header = CacheHeader();
+	std::memcpy(header.magic, "PTBC", 4);
+	header.version = CacheVersion;
+	header.sourceHash = sourceHash;
+	header.bvhWidth = settings.width;
+	header.spatialSplits = settings.spatialSplits;
+	header.overlapBudget = settings.overlapBudget;
+	header.verticesSize = this->ssbVData.verticesSize;
+	header.verticesCount = this->ssbVData.verticesCount;
+	header.indicesCount = this->ssbVData.indicesCount;
+	header.nodesSize = this->bvhNodesSize;
+	header.nodeBytes = this->bvhNodeBytes;
+	header.subMeshesCount = (int32_t)this->subMeshes.size();
+	header.materialsCount = (int32_t)this->materials.size();
+	// Sections start 16 byte aligned
+	header.verticesOffset = (sizeof(CacheHeader) + 15) & ~15ull;
+	header.indicesOffset = (header.verticesOffset + verticesBytes + 15) & ~15ull;
+	header.nodesOffset = (header.indicesOffset + indicesBytes + 15) & ~15ull;
+	header.subMeshesOffset = (header.nodesOffset + this->bvhNodesSize + 15) & ~15ull;
+	header.triangleMaterialsOffset = (header.subMeshesOffset + subMeshesBytes + 15) & ~15ull;
+	header.materialsOffset = (header.triangleMaterialsOffset + triangleMaterialsBytes + 15) & ~15ull;
+
+	const std::string path = CachePath(filepath, settings);
+	const std::string tempPath = path + ".tmp";
+	{
+		std::ofstream stream = std::ofstream(tempPath, std::ios::binary);
+		if (!stream) { print("ERROR: Couldn't write the BVH cache " << path); return; }
+
+		const char padding[16] = {};
+		stream.write((const char*)&header, sizeof(CacheHeader));
+		stream.write(padding, header.verticesOffset - sizeof(CacheHeader));
+		stream.write((const char*)this->ssbVData.vertices, verticesBytes);
+		stream.write(padding, header.indicesOffset - header.verticesOffset - verticesBytes);
+		stream.write((const char*)this->ssbVData.indices, indicesBytes);
+		stream.write(padding, header.nodesOffset - header.indicesOffset - indicesBytes);
+		stream.write((const char*)this->bvhNodes, this->bvhNodesSize);
+		stream.write(padding, header.subMeshesOffset - header.nodesOffset - this->bvhNodesSize);
+		stream.write((const char*)this->subMeshes.data(), subMeshesBytes);
+		stream.write(padding, header.triangleMaterialsOffset - header.subMeshesOffset - subMeshesBytes);
+		stream.write((const char*)this->ssbVData.triangleMaterials, triangleMaterialsBytes);
+		stream.write(padding, header.materialsOffset - header.triangleMaterialsOffset - triangleMaterialsBytes);
+		stream.write((const char*)this->materials.data(), this->materials.size() * sizeof(MeshMaterial));
+	}
+
+	ReplaceFile(tempPath, path);
+}
+
+bool OBJLoader::IsMapped(const void* data) const {
+	for (const MappedFile* file : { this->cache, this->mesh })
+		if (file && data >= file->GetData() && data < file->GetData() + file->GetSize()) return true;
+	return false;
+}
+
+// Binary mesh
+
+bool OBJLoader::IsMeshFile(const char* filepath) {
+	const size_t length = std::strlen(filepath), extensionLength = std::strlen(MeshExtension);
+	return length >= extensionLength && std::strcmp(filepath + length - extensionLength, MeshExtension) == 0;
+}
+
+bool OBJLoader::ConvertToMesh(const char* objPath, const char* meshPath, unsigned int threadsCount) {
+	// Taken before parsing, an edit made meanwhile leaves the binary mesh out of date
+	uint64_t sourceSize = 0;
+	int64_t sourceTime = 0;
+	if (!StatFile(objPath, sourceSize, sourceTime)) { print("ERROR: Couldn't find " << objPath); return false; }
+	const uint64_t sourceHash = HashSource(objPath);
+
+	OBJLoader obj;
+	if (!obj.Load(objPath, false, threadsCount)) { print("ERROR: Nothing to convert in " << objPath); return false; }
+	return obj.SaveMesh(meshPath, sourceHash, sourceSize, sourceTime);
+}
+
+bool OBJLoader::IsMeshCurrent(const char* meshPath, const char* objPath) {
+	MappedFile file(meshPath);
+	const MeshHeader* header = (const MeshHeader*)file.GetData();
+	if (!file.IsOpen() || file.GetSize() < sizeof(MeshHeader) || std::memcmp(header->magic, "PTMS", 4) != 0 ||
+		header->version != MeshVersion || header->vertexStride != Vertex::GetSSBStride()) return false;
+
+	uint64_t sourceSize = 0;
+	int64_t sourceTime = 0;
+	if (!StatFile(objPath, sourceSize, sourceTime)) return true; // Shipped without its OBJ
+	if (sourceSize != header->sourceSize) return false;
+	if (sourceTime == header->sourceTime) return true;
+
+	// Written again (a checkout, a copy) but maybe the same, the content decides
+	return header->sourceHash == HashSource(objPath);
+}
+
+bool OBJLoader::LoadMesh(const char* filepath) {
+	Timer timer;
+	MappedFile* file = new MappedFile(filepath);
+
+	const MeshHeader* header = (const MeshHeader*)file->GetData();
+	bool valid = file->IsOpen() && file->GetSize() >= sizeof(MeshHeader) &&
+		std::memcmp(header->magic, "PTMS", 4) == 0 && header->version == MeshVersion && header->vertexStride == Vertex::GetSSBStride() &&
+		header->verticesOffset % 16 == 0 && header->indicesOffset % 16 == 0 && header->triangleMaterialsOffset % 16 == 0 &&
+		header->verticesOffset + (uint64_t)header->verticesCount * header->vertexStride * sizeof(float) <= file->GetSize() &&
+		header->indicesOffset + (uint64_t)header->indicesCount * sizeof(unsigned int) <= file->GetSize() &&
+		header->subMeshesOffset + (uint64_t)header->subMeshesCount * sizeof(SubMesh) <= file->GetSize() &&
+		header->triangleMaterialsOffset + (uint64_t)header->indicesCount / 3 * sizeof(unsigned int) <= file->GetSize() &&
+		header->materialsOffset + (uint64_t)header->materialsCount * sizeof(MeshMaterial) <= file->GetSize();
+
+	if (!valid) { print("ERROR: " << filepath << " isn't a version " << MeshVersion << " binary mesh"); delete file; return false; }
+
+	// Nothing gets unpacked, the blocks are read only and go straight to SSBO::SendData
+	this->mesh = file;
+	this->ssbVData.vertices = (float*)(file->GetData() + header->verticesOffset);
+	this->ssbVData.verticesSize = header->verticesCount * header->vertexStride;
+	this->ssbVData.verticesCount = header->verticesCount;
+	this->ssbVData.indices = (unsigned int*)(file->GetData() + header->indicesOffset);
+	this->ssbVData.indicesCount = header->indicesCount;
+	this->ssbVData.triangleMaterials = (unsigned int*)(file->GetData() + header->triangleMaterialsOffset);
+	const SubMesh* subMeshes = (const SubMesh*)(file->GetData() + header->subMeshesOffset);
+	this->subMeshes.assign(subMeshes, subMeshes + header->subMeshesCount);
+	const MeshMaterial* materials = (const MeshMaterial*)(file->GetData() + header->materialsOffset);
+	this->materials.assign(materials, materials + header->materialsCount);
+
+	print("Mesh: mapped " << file->GetSize() / 1e6 << " MB in " << timer.GetMilliseconds() << " ms");
+	PrintSSBufferMemory();
+	return true;
+}
+
+bool OBJLoader::SaveMesh(const char* filepath, uint64_t sourceHash, uint64_t sourceSize, int64_t sourceTime) const {
+	const uint64_t verticesBytes = this->ssbVData.verticesSize * sizeof(float);
+	const uint64_t indicesBytes = this->ssbVData.indicesCount * sizeof(unsigned int);
+	const uint64_t subMeshesBytes = this->subMeshes.size() * sizeof(SubMesh);
+	const uint64_t triangleMaterialsBytes = this->ssbVData.indicesCount / 3 * sizeof(unsigned int);
+
+	MeshHeader header = MeshHeader();
+	std::memcpy(header.magic, "PTMS", 4);
+	header.version = MeshVersion;
+	header.sourceHash = sourceHash;
+	header.sourceSize = sourceSize;
+	header.sourceTime = sourceTime;
+	header.vertexStride = Vertex::GetSSBStride();
+	header.verticesCount = this->ssbVData.verticesCount;
+	header.indicesCount = this->ssbVData.indicesCount;
+	header.subMeshesCount = (int32_t)this->subMeshes.size();
+	header.materialsCount = (int32_t)this->materials.size();
+	header.verticesOffset = (sizeof(MeshHeader) + 15) & ~15ull;
+	header.indicesOffset = (header.verticesOffset + verticesBytes + 15) & ~15ull;
+	header.subMeshesOffset = (header.indicesOffset + indicesBytes + 15) & ~15ull;
+	header.triangleMaterialsOffset = (header.subMeshesOffset + subMeshesBytes + 15) & ~15ull;
+	header.materialsOffset = (header.triangleMaterialsOffset + triangleMaterialsBytes + 15) & ~15ull;
+
+	const std::string path = filepath;
+	const std::string tempPath = path + ".tmp";
+	{
+		std::ofstream stream = std::ofstream(tempPath, std::ios::binary);
+		if (!stream) { print("ERROR: Couldn't write the binary mesh " << path); return false; }
+
+		const char padding[16] = {};
+		stream.write((const char*)&header, sizeof(MeshHeader));
+		stream.write(padding, header.verticesOffset - sizeof(MeshHeader));
+		stream.write((const char*)this->ssbVData.vertices, verticesBytes);
+		stream.write(padding, header.indicesOffset - header.verticesOffset - verticesBytes);
+		stream.write((const char*)this->ssbVData.indices, indicesBytes);
+		stream.write(padding, header.subMeshesOffset - header.indicesOffset - indicesBytes);
+		stream.write((const char*)this->subMeshes.data(), subMeshesBytes);
+		stream.write(padding, header.triangleMaterialsOffset - header.subMeshesOffset - subMeshesBytes);
+		stream.write((const char*)this->ssbVData.triangleMaterials, triangleMaterialsBytes);
+		stream.write(padding, header.materialsOffset - header.triangleMaterialsOffset - triangleMaterialsBytes);
+		stream.write((const char*)this->materials.data(), this->materials.size() * sizeof(MeshMaterial));
+		if (!stream) { print("ERROR: Couldn't write the binary mesh " << path); return false; }
+	}
+
+	if (!ReplaceFile(tempPath, path)) { print("ERROR: Couldn't replace the binary mesh " << path); return false; }
+	print("Mesh: converted to " << path << ", " << (header.materialsOffset + this->materials.size() * sizeof(MeshMaterial)) / 1e6 << " MB, " << this->subMeshes.size() << " groups, " <<
+		this->materials.size() << " materials");
+	return true;
+}
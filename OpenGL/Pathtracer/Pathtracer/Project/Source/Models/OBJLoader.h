@@ -2,17 +2,66 @@
 #define OBJLOADER_H
 
 #include <vector>
+#include <string>
 #include <iostream>
+#include <cstdint>
 
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 
+#include "BVH.h"
+#include "WideBVH.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include "Material.h"
+
 struct Vertex {
 	glm::vec3 position;
 	glm::vec2 textureCoord;
 	glm::vec3 normal;
 
 	static int GetStride() { return (3*2 + 2); }
+	static int GetSSBStride() { return GetStride() + 4; } // std430: position, uv and normal padded to vec4s
+};
+
+// Optional SSBuffer vertex encoding, matches CompactVertex in pathtracer.glsl: the position, the octahedral normal
+// as 2 snorm16 and the uv as 2 halfs, 20 bytes instead of the 48 of the padded vertex
+struct CompactVertex {
+	float position[3];
+	uint32_t normal;
+	uint32_t uv;
+};
+
+// Triangle ready for intersection, matches Triangle in pathtracer.glsl:
+// the first vertex and the edges from it, with the geometric normal cross(edge1, edge2) in the w components
+struct TriangleData {
+	glm::vec4 v0;
+	glm::vec4 edge1;
+	glm::vec4 edge2;
+};
+
+// An 'o' or 'g' group of the OBJ, or the whole mesh when it has none. Every group gets its own BVH,
+// a group too big for one wide BVH takes a few (see OBJLoader::BuildBVH)
+struct SubMesh {
+	int indicesStart = 0; // In the SSBuffer indices, 3 per triangle
+	int indicesCount = 0;
+	int bvhRoot = 0; // In the BVH nodes, the children of the group nodes are indexed from it
+	AABB bounds; // BVH root bounds
+};
+
+// A material of the OBJ material libraries (.mtl), map_Kd goes in texturePath (relative to the working directory, empty for none).
+// Fixed size, so the materials go into the cache and the binary mesh as they are
+struct MeshMaterial {
+	Material material;
+	char texturePath[256] = {};
+};
+
+// How OBJLoader builds the mesh BVH
+struct BVHSettings {
+	int width = 2; // 2 is the binary BVH, 4 or 8 also collapse it into a WideBVH
+	bool spatialSplits = false; // SBVH instead of the binned SAH build
+	float overlapBudget = 1e-5f; // See BVH::BuildSpatial
+	unsigned int threadsCount = 0; // Of the OBJ parse and the BVH build, 0 uses every hardware thread
 };
 
 class OBJLoader {
@@ -27,31 +76,185 @@ class OBJLoader {
 		int verticesSize = 0; // Considers Stride, but not type
 		int verticesCount = 0; // Just the vertices count
 
+		// SSBuffer only: the vertices are unique and the triangles index them, 3 indices per triangle
+		unsigned int* indices = nullptr;
+		int indicesCount = 0;
+		// One per triangle: 0 is the material the mesh gets added with, n is the n-th material of the libraries
+		unsigned int* triangleMaterials = nullptr;
+
 		//float* vPos = nullptr; // Only the vertex positions
 		//float* vNPos = nullptr; // Only the vertex position and normals
 	};
 
 	VertexData vData;
 	VertexData ssbVData;
+	std::vector<SubMesh> subMeshes = std::vector<SubMesh>(); // In the SSBuffer indices order
+	std::vector<MeshMaterial> materials = std::vector<MeshMaterial>(); // Of every mtllib, in their order
+
+	// The mtllib and usemtl lines ParseMapped found, for LoadMaterials to resolve
+	struct MaterialUse {
+		int triangle; // First triangle using it
+		std::string name;
+	};
+	std::vector<std::string> materialLibraries = std::vector<std::string>();
+	std::vector<MaterialUse> materialUses = std::vector<MaterialUse>();
+
+	BVH bvh; // Of the last group built
+	WideBVH wideBVH;
+	std::vector<unsigned int> builtNodes = std::vector<unsigned int>(); // Every group BVH, one after the other
+
+	// Nodes of the BVHs the shader traverses (binary or wide), from the built BVHs or the cache
+	const void* bvhNodes = nullptr;
+	size_t bvhNodesSize = 0; // Bytes
+	uint32_t bvhNodeBytes = 0;
+
+	// BVH cache, "<asset>.bvh<width>.cache": the header, then the SSBuffer vertices and indices, the BVH nodes, the groups,
+	// the triangle materials and the materials
+	struct CacheHeader {
+		char magic[4];
+		uint32_t version;
+		uint64_t sourceHash;
+		int32_t bvhWidth;
+		int32_t spatialSplits;
+		float overlapBudget;
+		int32_t verticesSize;
+		int32_t verticesCount;
+		int32_t indicesCount;
+		uint64_t nodesSize;
+		uint32_t nodeBytes;
+		int32_t subMeshesCount;
+		int32_t materialsCount;
+		uint64_t verticesOffset;
+		uint64_t indicesOffset;
+		uint64_t nodesOffset;
+		uint64_t subMeshesOffset;
+		uint64_t triangleMaterialsOffset;
+		uint64_t materialsOffset;
+	};
+	static constexpr uint32_t CacheVersion = 6;
+
+	MappedFile* cache = nullptr; // Backs the ssbVData vertices, indices and triangle materials, and bvhNodes when loaded from the cache
+
+	// Binary mesh, "<name>.ptmesh": the header, then the SSBuffer vertices (std430, Vertex::GetSSBStride floats each)
+	// and indices, 16 byte aligned so both blocks go to SSBO::SendData as they are mapped, the groups, the triangle materials and the materials
+	struct MeshHeader {
+		char magic[4];
+		uint32_t version;
+		uint64_t sourceHash; // Of the OBJ it was converted from
+		uint64_t sourceSize; // Of the OBJ as well, with its last write time they spare hashing it when it wasn't touched
+		int64_t sourceTime;
+		int32_t vertexStride; // Floats
+		int32_t verticesCount;
+		int32_t indicesCount;
+		int32_t subMeshesCount;
+		int32_t materialsCount;
+		uint64_t verticesOffset;
+		uint64_t indicesOffset;
+		uint64_t subMeshesOffset;
+		uint64_t triangleMaterialsOffset;
+		uint64_t materialsOffset;
+	};
+	static constexpr uint32_t MeshVersion = 5;
+
+	// Backs the ssbVData vertices, and the indices and triangle materials until the BVH reorders them, when loaded from a binary mesh
+	MappedFile* mesh = nullptr;
+
+	// Mapped OBJ parsing, files are split in chunks of about ParseChunkSize bytes parsed in parallel
+	struct ParseCounts {
+		int positions = 0;
+		int textureCoords = 0;
+		int normals = 0;
+		int triangles = 0;
+	};
+	static constexpr size_t ParseChunkSize = 1 << 22;
 
 public:
 	OBJLoader(const char* filepath);
+	// Loads the mesh together with its BVH, mapping them from the BVH cache when it matches the source
+	OBJLoader(const char* filepath, const BVHSettings& settings);
 
-	~OBJLoader() { delete[] vData.vertices; delete[] ssbVData.vertices; };
+	// Parses the OBJ with the getline and the mapped parsers, and prints the throughput of both
+	static void CompareParsers(const char* filepath);
+
+	// Writes the OBJ as a binary mesh, which the constructors load instead of parsing when the path ends with MeshExtension.
+	// The parse runs on threadsCount threads, like BVHSettings::threadsCount (0 uses every hardware thread)
+	static bool ConvertToMesh(const char* objPath, const char* meshPath, unsigned int threadsCount = 0);
+	// Whether the binary mesh is there, of this version, and converted from the OBJ as it is now.
+	// The OBJ only gets hashed when its size is the same but its last write time isn't
+	static bool IsMeshCurrent(const char* meshPath, const char* objPath);
+	static constexpr const char* MeshExtension = ".ptmesh";
+
+	~OBJLoader() {
+		delete[] vData.vertices;
+		if (!IsMapped(ssbVData.vertices)) delete[] ssbVData.vertices;
+		if (!IsMapped(ssbVData.indices)) delete[] ssbVData.indices;
+		if (!IsMapped(ssbVData.triangleMaterials)) delete[] ssbVData.triangleMaterials;
+		delete cache;
+		delete mesh;
+	};
 
 private:
+	OBJLoader() {};
+
 	glm::vec3 LoadVertexData(const std::string& data);
 	std::vector<Vertex> LoadFace(const std::string& face);
 	Vertex CreateVertex(const std::string& indicies);
-	void CreateVertexArray(const std::vector<Vertex>& loadedVertices);
-	void CreateSSBuffer(const std::vector<Vertex>& loadedVertices);
+	void CreateVertexArray(const std::vector<glm::ivec3>& corners);
+	void CreateSSBuffer(const std::vector<glm::ivec3>& corners);
+	// The vertex array is for rasterizing, the pathtracer only reads the SSBuffer. False when there's nothing loaded.
+	// Big OBJs get parsed on threadsCount threads (0 uses every hardware thread)
+	bool Load(const char* filepath, bool vertexArray = false, unsigned int threadsCount = 0);
+	// Outputs the position, uv and normal indices of every triangle corner (-1 when missing), splits them into the groups
+	// and keeps the material lines for LoadMaterials. Without a pool the whole file is parsed as one chunk on the calling thread
+	void ParseMapped(const char* data, const char* end, std::vector<glm::ivec3>& corners, ThreadPool* pool = nullptr);
+	Vertex CornerVertex(const glm::ivec3& corner) const;
+	// Parses the material libraries next to the OBJ and gives every triangle its material, missing ones fall back to 0
+	void LoadMaterials(const char* filepath);
+	void PrintSSBufferMemory() const;
+	void ParseLines(const char* filepath, std::vector<Vertex>& objVertices);
+
+	static uint64_t HashSource(const char* filepath);
+	// The BVH cache key of a source: the hash of an OBJ, or for a binary mesh the hash of its OBJ (it's made from it) and MeshVersion
+	static uint64_t SourceKey(const char* filepath);
+	static std::string CachePath(const char* filepath, const BVHSettings& settings);
+	bool LoadCache(const char* filepath, const BVHSettings& settings, uint64_t sourceHash);
+	void SaveCache(const char* filepath, const BVHSettings& settings, uint64_t sourceHash) const;
+
+	static bool IsMeshFile(const char* filepath);
+	bool LoadMesh(const char* filepath);
+	bool SaveMesh(const char* filepath, uint64_t sourceHash, uint64_t sourceSize, int64_t sourceTime) const;
+	// Whether the data lies in the cache or mesh mapping, which own it
+	bool IsMapped(const void* data) const;
 
 public:
+	// Builds a BVH over the triangles of every group and reorders the group triangles to match its leaves
+	// (spatial splits duplicate the triangles referenced by several leaves)
+	void BuildBVH(const BVHSettings& settings = BVHSettings());
+
 	VertexData GetVerticesAsSSBuffer() const { return ssbVData; };
 
 	VertexData GetVertices() const { return vData; }
 
+	// The intersection triangles aren't kept, they get computed a range at a time while uploading them
+	void CreateTriangles(int first, int count, TriangleData* triangles) const;
+	int GetTrianglesCount() const { return ssbVData.indicesCount / 3; }
+
+	// Same for the compact vertices, encoded from the SSBuffer ones
+	void CreateCompactVertices(int first, int count, CompactVertex* vertices) const;
+
 	std::vector<glm::vec3> GetPositions() const { return positions; }
+
+	const BVH& GetBVH() const { return bvh; }
+
+	const WideBVH& GetWideBVH() const { return wideBVH; }
+
+	const std::vector<SubMesh>& GetSubMeshes() const { return subMeshes; }
+
+	const std::vector<MeshMaterial>& GetMaterials() const { return materials; }
+
+	const void* GetBVHNodes() const { return bvhNodes; }
+	size_t GetBVHNodesSize() const { return bvhNodesSize; }
+	uint32_t GetBVHNodeBytes() const { return bvhNodeBytes; }
 };
 
 #endif // !OBJLOADER_H
@@ -0,0 +1,240 @@
+#include "BVH.h"
+
+#include <algorithm>
+
+// Spatial split BVH build, see BVH::BuildSpatial
+
+namespace {
+	AABB Intersect(const AABB& a, const AABB& b) {
+		AABB intersection = { glm::max(a.min, b.min), glm::min(a.max, b.max) };
+		return intersection.Empty() ? AABB() : intersection;
+	}
+
+	// Bounds of the part of the triangle inside the slab lo <= p[axis] <= hi
+	AABB ClipTriangle(const glm::vec3* vertices, int axis, float lo, float hi) {
+		AABB bounds = AABB();
+		for (int i = 0; i < 3; i++) {
+			const glm::vec3& a = vertices[i];
+			const glm::vec3& b = vertices[(i + 1) % 3];
+			if (a[axis] >= lo && a[axis] <= hi) bounds.Grow(a);
+
+			for (float plane : { lo, hi }) {
+				if ((a[axis] < plane) == (b[axis] < plane) || a[axis] == plane || b[axis] == plane) continue;
+				glm::vec3 crossing = glm::mix(a, b, (plane - a[axis]) / (b[axis] - a[axis]));
+				crossing[axis] = plane;
+				bounds.Grow(crossing);
+			}
+		}
+		return bounds;
+	}
+}
+
+void BVH::BuildSpatial(const std::vector<glm::vec3>& triangles, float overlapBudget) {
+	const unsigned int primCount = (unsigned int)triangles.size() / 3;
+
+	this->nodes.clear();
+	this->parents.clear();
+	this->primIndices.clear();
+	this->nodesCost = 0.0f;
+
+	if (primCount == 0) return;
+
+	std::vector<Reference> refs = std::vector<Reference>(primCount);
+	AABB rootBounds = AABB();
+	for (unsigned int i = 0; i < primCount; i++) {
+		refs[i].prim = i;
+		for (int v = 0; v < 3; v++) refs[i].bounds.Grow(triangles[i * 3 + v]);
+		rootBounds.Grow(refs[i].bounds);
+	}
+
+	this->nodes.push_back(BVHNode());
+	this->parents.push_back(-1);
+
+	SubdivideSpatial(triangles, rootBounds.Area() * overlapBudget, 0, refs, 0);
+	FinishTopology();
+}
+
+void BVH::SubdivideSpatial(const std::vector<glm::vec3>& triangles, float minOverlap, unsigned int nodeIndex, std::vector<Reference>& refs, int depth) {
+	const int refsCount = (int)refs.size();
+
+	AABB nodeBounds = AABB();
+	for (const Reference& ref : refs) nodeBounds.Grow(ref.bounds);
+	this->nodes[nodeIndex].aabbMin = nodeBounds.min;
+	this->nodes[nodeIndex].aabbMax = nodeBounds.max;
+
+	auto makeLeaf = [&]() {
+		this->nodes[nodeIndex].leftFirst = (int)this->primIndices.size();
+		this->nodes[nodeIndex].primCount = refsCount;
+		for (const Reference& ref : refs) this->primIndices.push_back(ref.prim);
+	};
+
+	if (refsCount <= 1 || depth >= MaxDepth) { makeLeaf(); return; }
+
+	SplitCandidate objectSplit = FindObjectSplit(refs);
+	SplitCandidate spatialSplit = SplitCandidate();
+
+	// Spatial splits only pay off where the object split children overlap
+	AABB overlap = Intersect(objectSplit.leftBounds, objectSplit.rightBounds);
+	if (objectSplit.cost == FLT_MAX || overlap.Area() > minOverlap)
+		spatialSplit = FindSpatialSplit(triangles, refs, nodeBounds);
+
+	const bool useSpatial = spatialSplit.cost < objectSplit.cost;
+	const float splitCost = std::min(objectSplit.cost, spatialSplit.cost);
+	// Unlike the binned build, the traversal step is priced in, else splitting the clipped references never stops
+	const float nodeArea = nodeBounds.Area();
+	if (TraversalCost * nodeArea + IntersectionCost * splitCost >= IntersectionCost * refsCount * nodeArea) { makeLeaf(); return; }
+
+	std::vector<Reference> left = std::vector<Reference>();
+	std::vector<Reference> right = std::vector<Reference>();
+
+	if (useSpatial) {
+		const int axis = spatialSplit.axis;
+		const float position = spatialSplit.position;
+		for (const Reference& ref : refs) {
+			if (ref.bounds.max[axis] <= position) { left.push_back(ref); continue; }
+			if (ref.bounds.min[axis] >= position) { right.push_back(ref); continue; }
+
+			// Straddles the plane: each side references the part of the triangle on it
+			const glm::vec3* vertices = &triangles[ref.prim * 3];
+			Reference leftRef = { Intersect(ClipTriangle(vertices, axis, -FLT_MAX, position), ref.bounds), ref.prim };
+			Reference rightRef = { Intersect(ClipTriangle(vertices, axis, position, FLT_MAX), ref.bounds), ref.prim };
+			if (!leftRef.bounds.Empty()) left.push_back(leftRef);
+			if (!rightRef.bounds.Empty()) right.push_back(rightRef);
+		}
+	}
+	else {
+		for (const Reference& ref : refs) {
+			if (BinIndex(ref.bounds.Center(), objectSplit.axis, objectSplit.centroidBounds) < objectSplit.bin) left.push_back(ref);
+			else right.push_back(ref);
+		}
+	}
+
+	if (left.empty() || right.empty() || (int)std::min(left.size(), right.size()) == refsCount) { makeLeaf(); return; }
+
+	// The children copies hold every reference from here on
+	refs.clear();
+	refs.shrink_to_fit();
+
+	const unsigned int leftIndex = (unsigned int)this->nodes.size();
+	this->nodes.push_back(BVHNode());
+	this->nodes.push_back(BVHNode());
+	this->parents.push_back(nodeIndex);
+	this->parents.push_back(nodeIndex);
+
+	this->nodes[nodeIndex].leftFirst = leftIndex;
+	this->nodes[nodeIndex].primCount = 0;
+
+	SubdivideSpatial(triangles, minOverlap, leftIndex, left, depth + 1);
+	SubdivideSpatial(triangles, minOverlap, leftIndex + 1, right, depth + 1);
+}
+
+BVH::SplitCandidate BVH::FindObjectSplit(const std::vector<Reference>& refs) const {
+	SplitCandidate best = SplitCandidate();
+
+	for (const Reference& ref : refs) best.centroidBounds.Grow(ref.bounds.Center());
+	const AABB& centroidBounds = best.centroidBounds;
+
+	for (int a = 0; a < 3; a++) {
+		if (centroidBounds.max[a] == centroidBounds.min[a]) continue;
+
+		Bin bins[BinsCount];
+		for (const Reference& ref : refs) {
+			Bin& bin = bins[BinIndex(ref.bounds.Center(), a, centroidBounds)];
+			bin.primCount++;
+			bin.bounds.Grow(ref.bounds);
+		}
+
+		AABB leftBoxes[BinsCount - 1], rightBoxes[BinsCount - 1];
+		int leftCount[BinsCount - 1], rightCount[BinsCount - 1];
+		AABB leftBox, rightBox;
+		int leftSum = 0, rightSum = 0;
+		for (int i = 0; i < BinsCount - 1; i++) {
+			leftSum += bins[i].primCount;
+			leftCount[i] = leftSum;
+			leftBox.Grow(bins[i].bounds);
+			leftBoxes[i] = leftBox;
+
+			rightSum += bins[BinsCount - 1 - i].primCount;
+			rightCount[BinsCount - 2 - i] = rightSum;
+			rightBox.Grow(bins[BinsCount - 1 - i].bounds);
+			rightBoxes[BinsCount - 2 - i] = rightBox;
+		}
+
+		for (int i = 0; i < BinsCount - 1; i++) {
+			if (leftCount[i] == 0 || rightCount[i] == 0) continue;
+
+			float planeCost = leftCount[i] * leftBoxes[i].Area() + rightCount[i] * rightBoxes[i].Area();
+			if (planeCost >= best.cost) continue;
+
+			best.cost = planeCost;
+			best.axis = a;
+			best.bin = i + 1;
+			best.leftBounds = leftBoxes[i];
+			best.rightBounds = rightBoxes[i];
+		}
+	}
+
+	return best;
+}
+
+BVH::SplitCandidate BVH::FindSpatialSplit(const std::vector<glm::vec3>& triangles, const std::vector<Reference>& refs, const AABB& nodeBounds) const {
+	struct SpatialBin { AABB bounds; int entries = 0; int exits = 0; };
+	SplitCandidate best = SplitCandidate();
+
+	for (int a = 0; a < 3; a++) {
+		const float origin = nodeBounds.min[a];
+		const float binWidth = (nodeBounds.max[a] - origin) / BinsCount;
+		if (binWidth <= 0.0f) continue;
+
+		auto binOf = [&](float position) { return std::min(BinsCount - 1, std::max(0, (int)((position - origin) / binWidth))); };
+
+		// Every reference is chopped into the bins it spans
+		SpatialBin bins[BinsCount];
+		for (const Reference& ref : refs) {
+			const int firstBin = binOf(ref.bounds.min[a]);
+			const int lastBin = binOf(ref.bounds.max[a]);
+			bins[firstBin].entries++;
+			bins[lastBin].exits++;
+
+			if (firstBin == lastBin) { bins[firstBin].bounds.Grow(ref.bounds); continue; }
+
+			const glm::vec3* vertices = &triangles[ref.prim * 3];
+			for (int b = firstBin; b <= lastBin; b++) {
+				const float lo = origin + b * binWidth;
+				const float hi = b == BinsCount - 1 ? nodeBounds.max[a] : lo + binWidth;
+				bins[b].bounds.Grow(Intersect(ClipTriangle(vertices, a, lo, hi), ref.bounds));
+			}
+		}
+
+		AABB leftBoxes[BinsCount - 1], rightBoxes[BinsCount - 1];
+		int leftCount[BinsCount - 1], rightCount[BinsCount - 1];
+		AABB leftBox, rightBox;
+		int leftSum = 0, rightSum = 0;
+		for (int i = 0; i < BinsCount - 1; i++) {
+			leftSum += bins[i].entries;
+			leftCount[i] = leftSum;
+			leftBox.Grow(bins[i].bounds);
+			leftBoxes[i] = leftBox;
+
+			rightSum += bins[BinsCount - 1 - i].exits;
+			rightCount[BinsCount - 2 - i] = rightSum;
+			rightBox.Grow(bins[BinsCount - 1 - i].bounds);
+			rightBoxes[BinsCount - 2 - i] = rightBox;
+		}
+
+		for (int i = 0; i < BinsCount - 1; i++) {
+			if (leftCount[i] == 0 || rightCount[i] == 0) continue;
+
+			float planeCost = leftCount[i] * leftBoxes[i].Area() + rightCount[i] * rightBoxes[i].Area();
+			if (planeCost >= best.cost) continue;
+
+			best.cost = planeCost;
+			best.axis = a;
+			best.position = origin + (i + 1) * binWidth;
+			best.leftBounds = leftBoxes[i];
+			best.rightBounds = rightBoxes[i];
+		}
+	}
+
+	return best;
+}
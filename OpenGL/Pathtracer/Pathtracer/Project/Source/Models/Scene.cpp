@@ -0,0 +1,253 @@
+#include "Scene.h"
+
+#include <algorithm>
+#include <climits>
+
+#include "Source/Utils.h"
+
+AABB ObjectInfo::GetBounds() const {
+	// Spheres use size as the radius and boxes as the half extents, both fit in the same box
+	glm::vec3 center = glm::vec3(this->position);
+	AABB bounds = AABB();
+	bounds.Grow(center - glm::vec3(this->size));
+	bounds.Grow(center + glm::vec3(this->size));
+	return bounds;
+}
+
+int Scene::AddMaterial(const Material& material) {
+	this->materials.push_back(material);
+	return (int)this->materials.size() - 1;
+}
+
+int Scene::AddTexture(const std::string& path) {
+	auto found = std::find(this->texturePaths.begin(), this->texturePaths.end(), path);
+	if (found != this->texturePaths.end()) return (int)(found - this->texturePaths.begin());
+	this->texturePaths.push_back(path);
+	return (int)this->texturePaths.size() - 1;
+}
+
+void Scene::AddMesh(const OBJLoader& mesh, const glm::vec4& transform, int texture, int material) {
+	PackedMesh packed = this->packedTotals;
+	packed.mesh = &mesh;
+	this->packedMeshes.push_back(packed);
+
+	const int materialsStart = (int)this->materials.size();
+	for (const MeshMaterial& meshMaterial : mesh.GetMaterials()) {
+		Material added = meshMaterial.material;
+		if (meshMaterial.texturePath[0] != '\0') added.texture = AddTexture(meshMaterial.texturePath);
+		AddMaterial(added);
+	}
+
+	const size_t nodesStart = mesh.GetBVHNodeBytes() ? packed.nodesStart / mesh.GetBVHNodeBytes() : 0;
+	for (const SubMesh& subMesh : mesh.GetSubMeshes()) {
+		MeshInfo info = MeshInfo();
+		info.indicesStart = (int)packed.indicesStart + subMesh.indicesStart;
+		info.indicesCount = subMesh.indicesCount;
+		info.bvhRoot = (int)nodesStart + subMesh.bvhRoot;
+		info.verticesStart = (int)packed.verticesStart;
+		for (int a = 0; a < 4; a++) info.gPos[a] = transform[a];
+		info.texture = texture;
+		info.material = material;
+		info.materialsStart = materialsStart;
+
+		this->meshes.push_back(info);
+		this->meshBounds.push_back(subMesh.bounds);
+	}
+
+	const auto vertexData = mesh.GetVerticesAsSSBuffer();
+	this->packedTotals.verticesStart += vertexData.verticesCount;
+	this->packedTotals.indicesStart += vertexData.indicesCount;
+	this->packedTotals.nodesStart += mesh.GetBVHNodesSize();
+}
+
+bool Scene::UploadMeshes(size_t uploadBudget, bool compactVertices) {
+	const size_t vertexBytes = Vertex::GetSSBStride() * sizeof(float);
+	const PackedMesh& totals = this->packedTotals;
+
+	// Checked up front, so a mesh too big fails before anything goes up
+	if (totals.verticesStart > INT_MAX || totals.indicesStart > INT_MAX || totals.nodesStart / sizeof(BVHNode) > INT_MAX) {
+		print("ERROR: The packed meshes are over the " << INT_MAX << " vertices, indices or BVH nodes MeshInfo can index");
+		return false;
+	}
+	for (size_t bytes : { totals.verticesStart * (compactVertices ? sizeof(CompactVertex) : vertexBytes), totals.indicesStart * sizeof(unsigned int),
+		totals.indicesStart / 3 * sizeof(TriangleData), totals.nodesStart })
+		if (!SSBO::CanAddress(bytes)) return false;
+
+	this->meshInfoSSBO.Bind(10);
+	this->meshInfoSSBO.SendData(this->meshes.size() * sizeof(MeshInfo), (void*)this->meshes.data());
+	this->meshInfoSSBO.Unbind();
+
+	// Each buffer is allocated for every mesh, then filled mesh by mesh a chunk at a time
+
+	this->meshVerticesSSBO.Bind(11);
+	if (!compactVertices) {
+		this->meshVerticesSSBO.Allocate(totals.verticesStart * vertexBytes);
+		for (const PackedMesh& packed : this->packedMeshes) {
+			const auto vertexData = packed.mesh->GetVerticesAsSSBuffer();
+			this->meshVerticesSSBO.StreamSubData(packed.verticesStart * vertexBytes, vertexData.verticesCount * vertexBytes, vertexData.vertices, uploadBudget);
+		}
+	}
+	else {
+		// Encoded into a staging buffer of the budget size, like the triangles
+		const int chunkVertices = (int)std::max((size_t)1, std::min(uploadBudget / sizeof(CompactVertex), (size_t)INT_MAX));
+		std::vector<CompactVertex> staging = std::vector<CompactVertex>(std::min((int)totals.verticesStart, chunkVertices));
+
+		this->meshVerticesSSBO.Allocate(totals.verticesStart * sizeof(CompactVertex));
+		for (const PackedMesh& packed : this->packedMeshes) {
+			const int verticesCount = packed.mesh->GetVerticesAsSSBuffer().verticesCount;
+			for (int first = 0; first < verticesCount; first += chunkVertices) {
+				const int count = std::min(chunkVertices, verticesCount - first);
+				packed.mesh->CreateCompactVertices(first, count, staging.data());
+				this->meshVerticesSSBO.SendSubData((packed.verticesStart + first) * sizeof(CompactVertex), count * sizeof(CompactVertex), staging.data());
+			}
+		}
+		print("Mesh vertices: " << totals.verticesStart * sizeof(CompactVertex) / 1024.0f << " KB compact instead of " << totals.verticesStart * vertexBytes / 1024.0f << " KB");
+	}
+	this->meshVerticesSSBO.Unbind();
+
+	this->meshIndicesSSBO.Bind(19);
+	this->meshIndicesSSBO.Allocate(totals.indicesStart * sizeof(unsigned int));
+	for (const PackedMesh& packed : this->packedMeshes) {
+		const auto vertexData = packed.mesh->GetVerticesAsSSBuffer();
+		this->meshIndicesSSBO.StreamSubData(packed.indicesStart * sizeof(unsigned int), vertexData.indicesCount * sizeof(unsigned int), vertexData.indices, uploadBudget);
+	}
+	this->meshIndicesSSBO.Unbind();
+
+	this->meshTriangleMaterialsSSBO.Bind(26);
+	this->meshTriangleMaterialsSSBO.Allocate(totals.indicesStart / 3 * sizeof(unsigned int));
+	for (const PackedMesh& packed : this->packedMeshes) {
+		const auto vertexData = packed.mesh->GetVerticesAsSSBuffer();
+		this->meshTriangleMaterialsSSBO.StreamSubData(packed.indicesStart / 3 * sizeof(unsigned int), vertexData.indicesCount / 3 * sizeof(unsigned int), vertexData.triangleMaterials, uploadBudget);
+	}
+	this->meshTriangleMaterialsSSBO.Unbind();
+
+	this->meshBVHSSBO.Bind(13);
+	this->meshBVHSSBO.Allocate(totals.nodesStart);
+	for (const PackedMesh& packed : this->packedMeshes)
+		this->meshBVHSSBO.StreamSubData(packed.nodesStart, packed.mesh->GetBVHNodesSize(), packed.mesh->GetBVHNodes(), uploadBudget);
+	this->meshBVHSSBO.Unbind();
+
+	// The intersection triangles aren't kept by the meshes, they're computed into a staging buffer of the budget size
+	const int chunkTriangles = (int)std::max((size_t)1, std::min(uploadBudget / sizeof(TriangleData), (size_t)INT_MAX));
+	std::vector<TriangleData> staging = std::vector<TriangleData>(std::min((int)totals.indicesStart / 3, chunkTriangles));
+
+	this->meshTrianglesSSBO.Bind(16);
+	this->meshTrianglesSSBO.Allocate(totals.indicesStart / 3 * sizeof(TriangleData));
+	for (const PackedMesh& packed : this->packedMeshes) {
+		const int trianglesCount = packed.mesh->GetTrianglesCount();
+		for (int first = 0; first < trianglesCount; first += chunkTriangles) {
+			const int count = std::min(chunkTriangles, trianglesCount - first);
+			packed.mesh->CreateTriangles(first, count, staging.data());
+			this->meshTrianglesSSBO.SendSubData((packed.indicesStart / 3 + first) * sizeof(TriangleData), count * sizeof(TriangleData), staging.data());
+		}
+	}
+	this->meshTrianglesSSBO.Unbind();
+	return true;
+}
+
+std::vector<AABB> Scene::GetPrimitivesBounds() const {
+	// TLAS primitives: [0, objects) are ObjectInfos, [objects, objects + meshes) are mesh instances
+	std::vector<AABB> bounds = std::vector<AABB>();
+	bounds.reserve(this->objects.size() + this->meshes.size());
+
+	for (const ObjectInfo& object : this->objects) bounds.push_back(object.GetBounds());
+
+	for (int i = 0; i < this->meshes.size(); i++) {
+		const MeshInfo& mesh = this->meshes[i];
+		glm::vec3 position = glm::vec3(mesh.gPos[0], mesh.gPos[1], mesh.gPos[2]);
+		float scale = mesh.gPos[3];
+
+		AABB instanceBounds = AABB();
+		instanceBounds.Grow(this->meshBounds[i].min * scale + position);
+		instanceBounds.Grow(this->meshBounds[i].max * scale + position);
+		bounds.push_back(instanceBounds);
+	}
+
+	return bounds;
+}
+
+bool Scene::Update() {
+	const bool rebuilt = this->rebuild.valid() && this->rebuild.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	const bool resized = this->tlas.GetPrimIndices().size() != this->objects.size() + this->meshes.size();
+	// Comparing the materials with their last upload is cheaper than tracking every edit
+	const bool materialsChanged = this->materialsSSBO.Upload(25, this->materials);
+
+	const bool changed = resized || !this->dirtyPrims.empty() || !this->objectsUploaded;
+	if (!changed && !rebuilt) return materialsChanged;
+
+	std::vector<AABB> bounds = GetPrimitivesBounds();
+
+	if (rebuilt) {
+		this->tlas = this->rebuild.get();
+		// Objects may have kept moving while it was building
+		this->tlas.Refit(bounds);
+		this->builtCost = this->tlas.SAHCost();
+	}
+
+	if (resized || (!this->refit && changed)) {
+		this->tlas.Build(bounds);
+		this->builtCost = this->tlas.SAHCost();
+	}
+	else if (!this->dirtyPrims.empty()) {
+		this->tlas.Refit(bounds, this->dirtyPrims);
+
+		if (!this->rebuild.valid() && this->tlas.SAHCost() > this->builtCost * RebuildThreshold) {
+			this->rebuild = std::async(std::launch::async, [bounds]() {
+				BVH bvh = BVH();
+				bvh.Build(bounds);
+				return bvh;
+			});
+		}
+	}
+	this->dirtyPrims.clear();
+
+	const std::vector<BVHNode>& nodes = this->tlas.GetNodes();
+	const std::vector<unsigned int>& indices = this->tlas.GetPrimIndices();
+
+	const std::vector<unsigned int> objectPrims = UploadObjects();
+	const unsigned int objectsCount = (unsigned int)this->objects.size();
+	std::vector<unsigned int> prims = std::vector<unsigned int>(indices.size());
+	for (int p = 0; p < indices.size(); p++) {
+		const unsigned int i = indices[p];
+		prims[p] = i < objectsCount ? objectPrims[i] : ((unsigned int)ObjectType::MESH << PrimTypeShift) | (i - objectsCount);
+	}
+
+	this->tlasSSBO.Upload(14, nodes);
+	this->tlasIndicesSSBO.Upload(15, prims);
+	this->objectsUploaded = true;
+
+	return changed || materialsChanged;
+}
+
+std::vector<unsigned int> Scene::UploadObjects() {
+	std::vector<glm::vec4> spheres = std::vector<glm::vec4>();
+	std::vector<BoxData> boxes = std::vector<BoxData>();
+	std::vector<int> materials = std::vector<int>();
+	std::vector<int> boxMaterials = std::vector<int>();
+	std::vector<unsigned int> objectPrims = std::vector<unsigned int>(this->objects.size());
+
+	for (int i = 0; i < this->objects.size(); i++) {
+		const ObjectInfo& object = this->objects[i];
+		glm::vec3 center = glm::vec3(object.position);
+
+		if ((ObjectType)(int)object.type == ObjectType::SPHERE) {
+			objectPrims[i] = ((unsigned int)ObjectType::SPHERE << PrimTypeShift) | (unsigned int)spheres.size();
+			spheres.push_back(glm::vec4(center, object.size * object.size));
+			materials.push_back((int)object.matIndex);
+		}
+		else {
+			objectPrims[i] = ((unsigned int)ObjectType::BOX << PrimTypeShift) | (unsigned int)boxes.size();
+			boxes.push_back({ glm::vec4(center, 0.0f), glm::vec4(glm::vec3(object.size), 0.0f) });
+			boxMaterials.push_back((int)object.matIndex);
+		}
+	}
+
+	// The box materials follow the sphere ones
+	materials.insert(materials.end(), boxMaterials.begin(), boxMaterials.end());
+
+	this->spheresSSBO.Upload(12, spheres);
+	this->boxesSSBO.Upload(17, boxes);
+	this->objectMaterialsSSBO.Upload(18, materials);
+
+	return objectPrims;
+}
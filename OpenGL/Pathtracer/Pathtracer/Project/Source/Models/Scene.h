@@ -0,0 +1,149 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <vector>
+#include <string>
+#include <future>
+
+#include "glm/glm.hpp"
+
+#include "BVH.h"
+#include "Shader.h"
+#include "OBJLoader.h"
+#include "Material.h"
+
+enum class ObjectType {
+	SPHERE = 0,
+	BOX = 1,
+	MESH = 2 // Only tags mesh instances among the TLAS primitives
+};
+
+// Matches the ObjectInfo struct in pathtracer.glsl
+struct ObjectInfo {
+	glm::vec4 position;
+	float type;
+	float matIndex;
+	float size;
+	float w = 0.0f;
+	ObjectInfo(glm::vec4 position, unsigned int type, unsigned int matIndex, float size) :
+		position(position), type(type), matIndex(matIndex), size(size) {};
+
+	AABB GetBounds() const;
+};
+
+// Matches the BoxData struct in pathtracer.glsl. Spheres go up as a vec4 of center and radius squared
+struct BoxData {
+	glm::vec4 center;
+	glm::vec4 halfExtents;
+};
+
+// Matches the MeshInfo struct in pathtracer.glsl, one per mesh group. The starts index the packed mesh buffers of Scene
+struct MeshInfo {
+	int indicesStart; // First vertex index, 3 per triangle, the triangles are at indicesStart / 3
+	int indicesCount;
+	int bvhRoot;
+	int verticesStart; // Added to the vertex indices
+	float gPos[4]; // position, scale
+	int texture; // Layer in the mesh textures array for its material, -1 for none
+	int material; // Of the triangles without an MTL material
+	int materialsStart; // MTL material n of the mesh is at materialsStart + n - 1 in the materials table
+	int padding;
+};
+
+// Two level acceleration structure:
+// The TLAS is built over every ObjectInfo and mesh instance, and each mesh keeps its own BLAS (built by OBJLoader)
+class Scene {
+
+	// Where a loaded mesh goes in the packed mesh buffers
+	struct PackedMesh {
+		const OBJLoader* mesh;
+		size_t verticesStart;
+		size_t indicesStart;
+		size_t nodesStart; // Bytes
+	};
+
+	std::vector<ObjectInfo> objects = std::vector<ObjectInfo>();
+	std::vector<Material> materials = std::vector<Material>(); // Indexed by the objects, the meshes and the mesh triangles
+	std::vector<std::string> texturePaths = std::vector<std::string>(); // The mesh textures array layers
+	std::vector<MeshInfo> meshes = std::vector<MeshInfo>();
+	std::vector<AABB> meshBounds = std::vector<AABB>(); // BLAS root bounds, in mesh space
+	std::vector<PackedMesh> packedMeshes = std::vector<PackedMesh>();
+	PackedMesh packedTotals = { nullptr, 0, 0, 0 };
+
+	BVH tlas;
+
+	// Refit mode: moved objects only refit their TLAS paths, and a full rebuild runs in the background once
+	// the refits degrade the SAH cost past RebuildThreshold times the cost of the last build
+	bool refit = true;
+	float builtCost = 0.0f;
+	std::vector<unsigned int> dirtyPrims = std::vector<unsigned int>();
+	std::future<BVH> rebuild;
+
+	SSBO meshInfoSSBO;
+	SSBO meshVerticesSSBO;
+	SSBO meshIndicesSSBO;
+	SSBO meshTrianglesSSBO;
+	SSBO meshTriangleMaterialsSSBO;
+	SSBO meshBVHSSBO;
+	// Uploaded by Update, which only sends what changed
+	TrackedSSBO<Material> materialsSSBO;
+	TrackedSSBO<glm::vec4> spheresSSBO;
+	TrackedSSBO<BoxData> boxesSSBO;
+	TrackedSSBO<int> objectMaterialsSSBO;
+	TrackedSSBO<BVHNode> tlasSSBO;
+	TrackedSSBO<unsigned int> tlasIndicesSSBO;
+	bool objectsUploaded = false;
+
+public:
+	static constexpr float RebuildThreshold = 1.5f;
+	static constexpr unsigned int PrimTypeShift = 30; // TLAS primitives go up as ObjectType << PrimTypeShift | index in their type array
+
+	Scene() {};
+	~Scene() {};
+
+	void AddObject(const ObjectInfo& object) { this->objects.push_back(object); }
+	// Returns its index, for the objects matIndex and the meshes material
+	int AddMaterial(const Material& material);
+	// Returns the layer of the texture in the mesh textures array, a path already added keeps its layer
+	int AddTexture(const std::string& path);
+	// Every group of the mesh becomes an instance placed at the position, with the scale in w.
+	// The triangles without an MTL material get the material and texture, the MTL materials and textures get added after the others.
+	// The mesh has to stay alive until UploadMeshes, and every mesh needs the same BVH width
+	void AddMesh(const OBJLoader& mesh, const glm::vec4& transform, int texture, int material);
+
+	// Meshes don't move, so their info and geometry only go up once: the vertices, indices, intersection triangles, triangle materials
+	// and BVH nodes of every mesh are packed in one buffer each. They're sent uploadBudget bytes at a time, so the mapped blocks of a binary mesh
+	// or BVH cache are only paged in a chunk at a time, and the intersection triangles and compact vertices are computed into a staging buffer of that size.
+	// Compact vertices go up as CompactVertex, the shaders reading them need COMPACT_VERTICES.
+	// False, with nothing uploaded, when a buffer is over what a shader storage block (or the MeshInfo ints) can address
+	bool UploadMeshes(size_t uploadBudget, bool compactVertices = false);
+
+	// The GPU mesh BVH binds its own nodes at 13 over the packed ones
+	void BindMeshBVH() { this->meshBVHSSBO.Bind(13); }
+
+	// Flags an object whose bounds, type or material changed since the last Update
+	void MarkDirty(unsigned int objectIndex) { this->dirtyPrims.push_back(objectIndex); }
+
+	// Refits (or rebuilds, out of refit mode) the TLAS when objects changed or a background rebuild finished,
+	// and uploads the changed ranges of it, of the objects and of the materials. Returns whether the objects or materials changed,
+	// the image has to restart then
+	bool Update();
+
+private:
+	std::vector<AABB> GetPrimitivesBounds() const;
+
+	// Splits the objects by type into tightly packed sphere and box arrays, returns each object TLAS primitive
+	std::vector<unsigned int> UploadObjects();
+
+public:
+	inline std::vector<ObjectInfo>& GetObjects() { return this->objects; }
+	// Editable, the edits go up on the next Update
+	inline std::vector<Material>& GetMaterials() { return this->materials; }
+	inline const std::vector<MeshInfo>& GetMeshes() const { return this->meshes; }
+	inline std::vector<std::string>& GetTexturePaths() { return this->texturePaths; }
+	inline const BVH& GetTLAS() const { return this->tlas; }
+	inline bool& GetRefit() { return this->refit; }
+	inline bool IsRebuilding() const { return this->rebuild.valid(); }
+};
+
+#endif // !SCENE_H
@@ -4,48 +4,60 @@
 #include <fstream> // file stream
 #include <sstream> // string stream
 #include <ostream>
+#include <algorithm>
 
+#include "MappedFile.h"
 #include "Source/Utils.h"
 
-Shader::Shader(const char* filepath) : rendererID(0) {
-	ShadersData sources = Parse(filepath);
-	Create(sources);
+int Shader::cachedPrograms = 0;
+int Shader::compiledPrograms = 0;
+std::vector<std::weak_ptr<ShaderProgram>> Shader::programs = std::vector<std::weak_ptr<ShaderProgram>>();
+
+Shader::Shader(const char* filepath) : program(std::make_shared<ShaderProgram>()) {
+	Create(filepath, {});
+}
+Shader::Shader(const char* filepath, const std::vector<std::string>& defines) : program(std::make_shared<ShaderProgram>()) {
+	Create(filepath, defines);
 }
 Shader::~Shader() {}
 
-ShadersData Shader::Parse(const char* filepath) {
+ShadersData Shader::Parse(const char* filepath, const std::vector<std::string>& defines) {
 	std::ifstream stream = std::ifstream(filepath);
 	print(filepath << "\n\n");
 
 	if (!stream) { print("ERROR: Shader got a NULL directory"); return {}; }
 
 	std::string line;
-	std::stringstream shaderStream[2];
+	std::stringstream shaderStream[3];
 
 	const std::string vertexKeyword = "#VERTEX_SHADER";
 	const std::string fragKeyword = "#FRAGMENT_SHADER";
+	const std::string computeKeyword = "#COMPUTE_SHADER";
 	ShaderType type = ShaderType::VERTEX;
 	bool foundShader = false;
 
 	while (getline(stream, line)) {
 		if (line.find(vertexKeyword) != std::string::npos) { foundShader = true; continue; } // Found
 		if (line.find(fragKeyword) != std::string::npos) { foundShader = true; type = ShaderType::FRAGMENT; continue; }
+		if (line.find(computeKeyword) != std::string::npos) { foundShader = true; type = ShaderType::COMPUTE; continue; }
 		
 		if (foundShader == false) { continue; }
 
 		shaderStream[(int)type] << line << "\n";
+		if (line.find("#version") != std::string::npos)
+			for (const std::string& define : defines) shaderStream[(int)type] << "#define " << define << "\n";
 		//print(line);
 	}
 
 
-	return { shaderStream[0].str(), shaderStream[1].str() };
+	return { shaderStream[0].str(), shaderStream[1].str(), shaderStream[2].str() };
 }
 
 void StateHandle(unsigned int shaderID, ShaderType type) {
 	int  success;
 	char infoLog[512];
 	glGetShaderiv(shaderID, GL_COMPILE_STATUS, &success);
-	std::string errorLocation = type == ShaderType::VERTEX ? "VERTEX" : "FRAGMENT";
+	std::string errorLocation = type == ShaderType::VERTEX ? "VERTEX" : type == ShaderType::FRAGMENT ? "FRAGMENT" : "COMPUTE";
 	if (!success)
 	{
 		glGetShaderInfoLog(shaderID, 512, NULL, infoLog);
@@ -53,7 +65,7 @@ void StateHandle(unsigned int shaderID, ShaderType type) {
 	}
 }
 
-void Shader::Compile(ShadersData sources, unsigned int* shaders) {
+void Shader::Compile(const ShadersData& sources, unsigned int rendererID, unsigned int* shaders) {
 	unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
 	unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
 	const char* vsSource = sources.vertexSource.c_str();
@@ -63,9 +75,6 @@ void Shader::Compile(ShadersData sources, unsigned int* shaders) {
 	glCompileShader(vertexShader);
 	glCompileShader(fragmentShader);
 
-	StateHandle(vertexShader, ShaderType::VERTEX);
-	StateHandle(fragmentShader, ShaderType::FRAGMENT);
-
 	glAttachShader(rendererID, vertexShader);
 	glAttachShader(rendererID, fragmentShader);
 
@@ -73,22 +82,267 @@ void Shader::Compile(ShadersData sources, unsigned int* shaders) {
 	*(shaders+1) = fragmentShader;
 }
 
-void Shader::Create(ShadersData sources) {
-	this->rendererID = glCreateProgram();
-	
-	unsigned int shaders[2];
-	Compile(sources, shaders);
+unsigned int Shader::CompileCompute(const std::string& source, unsigned int rendererID) {
+	unsigned int computeShader = glCreateShader(GL_COMPUTE_SHADER);
+	const char* csSource = source.c_str();
+	glShaderSource(computeShader, 1, &csSource, NULL);
+	glCompileShader(computeShader);
+
+	glAttachShader(rendererID, computeShader);
+	return computeShader;
+}
+
+// FNV-1a, chained through hash to cover several strings
+uint64_t HashString(const std::string& string, uint64_t hash = 14695981039346656037ull) {
+	for (unsigned char c : string) {
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+uint64_t HashSources(const ShadersData& sources) {
+	return HashString(sources.vertexSource, HashString(sources.fragmentSource, HashString(sources.computeSource)));
+}
+
+// Prints the compile and link logs, shaders are the ones StartLink attached
+bool LinkHandle(unsigned int rendererID, const unsigned int* shaders) {
+	const bool compute = shaders[1] == 0;
+	StateHandle(shaders[0], compute ? ShaderType::COMPUTE : ShaderType::VERTEX);
+	if (!compute) StateHandle(shaders[1], ShaderType::FRAGMENT);
+
+	int linked = 0;
+	glGetProgramiv(rendererID, GL_LINK_STATUS, &linked);
+	if (!linked) {
+		char infoLog[512];
+		glGetProgramInfoLog(rendererID, 512, NULL, infoLog);
+		print("ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl);
+		return false;
+	}
+
+	if (!compute) glValidateProgram(rendererID);
+	return true;
+}
+
+void Shader::Create(const char* filepath, const std::vector<std::string>& defines) {
+	ShaderProgram& program = *this->program;
+	program.filepath = filepath;
+	program.defines = defines;
+	programs.push_back(this->program);
+
+	ShadersData sources = Parse(filepath, defines);
+	program.rendererID = glCreateProgram();
+	program.cachePath = program.filepath + ".cache";
+	program.sourceHash = HashSources(sources);
+
+	if (LoadBinary(program)) {
+		cachedPrograms++;
+		CacheUniformLocations(program);
+		return;
+	}
+
+	StartLink(sources, program.rendererID, program.shaders);
+	program.linking = true;
+	compiledPrograms++;
+}
 
-	unsigned int vs = *(shaders);
-	unsigned int fs = *(shaders+1);
+void Shader::StartLink(const ShadersData& sources, unsigned int rendererID, unsigned int* shaders) {
+	// Lets the driver compile on as many threads as it likes, so the programs created before their first Bind compile at once
+	static bool compilerThreadsSet = false;
+	if (!compilerThreadsSet && GLAD_GL_KHR_parallel_shader_compile) glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	compilerThreadsSet = true;
+
+	glProgramParameteri(rendererID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	shaders[0] = shaders[1] = 0;
+	if (!sources.computeSource.empty()) shaders[0] = CompileCompute(sources.computeSource, rendererID);
+	else Compile(sources, rendererID, shaders);
+
+	// Status queries would wait for the compile, they're left for LinkHandle.
+	// Deleted shaders live on (logs included) while attached
 	glLinkProgram(rendererID);
-	glValidateProgram(rendererID);
-	glDeleteShader(vs);
-	glDeleteShader(fs);
+	for (int i = 0; i < 2; i++) if (shaders[i] != 0) glDeleteShader(shaders[i]);
+}
+
+void Shader::FinishLink() const {
+	ShaderProgram& program = *this->program;
+	if (!program.linking) return;
+	program.linking = false;
+
+	if (LinkHandle(program.rendererID, program.shaders)) SaveBinary(program);
+	CacheUniformLocations(program);
+}
+
+void Shader::CacheUniformLocations(ShaderProgram& program) {
+	const unsigned int rendererID = program.rendererID;
+	std::unordered_map<std::string, int>& uniformLocations = program.uniformLocations;
+	uniformLocations.clear();
+	int uniformsCount = 0;
+	glGetProgramiv(rendererID, GL_ACTIVE_UNIFORMS, &uniformsCount);
+
+	char name[256];
+	for (int i = 0; i < uniformsCount; i++) {
+		GLsizei length = 0;
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveUniform(rendererID, i, sizeof(name), &length, &size, &type, name);
+
+		// Uniform block members have no location, their buffer holds them
+		const int location = glGetUniformLocation(rendererID, name);
+		if (location < 0) continue;
+
+		// Arrays are listed as "name[0]", and get set by their plain name too
+		const std::string uniformName = std::string(name, length);
+		uniformLocations[uniformName] = location;
+		const size_t bracket = uniformName.find('[');
+		if (bracket != std::string::npos) uniformLocations[uniformName.substr(0, bracket)] = location;
+	}
 }
 
 void Shader::Bind() const {
-	glUseProgram(this->rendererID);
+	FinishLink();
+	glUseProgram(this->program->rendererID);
+}
+
+void Shader::Reload(const std::string& filepath) {
+	for (size_t i = 0; i < programs.size();) {
+		std::shared_ptr<ShaderProgram> program = programs[i].lock();
+		if (!program) { programs.erase(programs.begin() + i); continue; } // Its Shaders are gone
+		i++;
+		if (program->filepath != filepath) continue;
+
+		ShadersData sources = Parse(filepath.c_str(), program->defines);
+		if (sources.vertexSource.empty() && sources.computeSource.empty()) continue; // Moved away, or caught mid write
+		const uint64_t sourceHash = HashSources(sources);
+
+		// An older edit still linking is dropped, unless it's this same source
+		if (program->reloadID != 0 && program->reloadHash == sourceHash) continue;
+		if (program->reloadID != 0) { glDeleteProgram(program->reloadID); program->reloadID = 0; }
+		if (sourceHash == program->sourceHash) continue;
+
+		program->reloadID = glCreateProgram();
+		program->reloadHash = sourceHash;
+		StartLink(sources, program->reloadID, program->reloadShaders);
+	}
+}
+
+bool Shader::SwapReloaded() {
+	bool swapped = false;
+	for (const std::weak_ptr<ShaderProgram>& weakProgram : programs) {
+		std::shared_ptr<ShaderProgram> program = weakProgram.lock();
+		if (!program || program->reloadID == 0) continue;
+
+		// Without the extension, the status queries below wait for the compile
+		if (GLAD_GL_KHR_parallel_shader_compile) {
+			int completed = 0;
+			glGetProgramiv(program->reloadID, GL_COMPLETION_STATUS_KHR, &completed);
+			if (!completed) continue;
+		}
+
+		const unsigned int reloadID = program->reloadID;
+		program->reloadID = 0;
+		if (!LinkHandle(reloadID, program->reloadShaders)) {
+			print("Shader: reload failed, keeping the running program " << program->filepath);
+			glDeleteProgram(reloadID);
+			continue;
+		}
+
+		// Deleting the bound program is deferred by GL until it's unbound
+		glDeleteProgram(program->rendererID);
+		program->rendererID = reloadID;
+		program->sourceHash = program->reloadHash;
+		program->linking = false;
+		SaveBinary(*program);
+		CacheUniformLocations(*program);
+		print("Shader: reloaded " << program->filepath);
+		swapped = true;
+	}
+	return swapped;
+}
+
+void Shader::Dispatch(unsigned int groupsX, unsigned int groupsY, unsigned int groupsZ) const {
+	glDispatchCompute(groupsX, groupsY, groupsZ);
+}
+
+
+// Program binary cache
+
+namespace {
+	// "<shader>.glsl.cache": the header, then the program binary
+	struct BinaryCacheHeader {
+		char magic[4];
+		uint32_t version;
+		uint64_t sourceHash;
+		uint64_t driverHash;
+		uint32_t binaryFormat;
+		uint32_t binarySize;
+	};
+	constexpr uint32_t BinaryCacheVersion = 1;
+
+	// Binaries only load back on the driver that made them
+	uint64_t DriverHash() {
+		static const uint64_t hash = HashString((const char*)glGetString(GL_VENDOR),
+			HashString((const char*)glGetString(GL_RENDERER), HashString((const char*)glGetString(GL_VERSION))));
+		return hash;
+	}
+
+	bool BinariesSupported() {
+		static const bool supported = [] { int formats = 0; glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats); return formats > 0; }();
+		return supported;
+	}
+}
+
+bool Shader::LoadBinary(ShaderProgram& program) {
+	if (!BinariesSupported()) return false;
+
+	std::ifstream stream = std::ifstream(program.cachePath, std::ios::binary);
+	if (!stream) return false;
+
+	BinaryCacheHeader header = BinaryCacheHeader();
+	stream.read((char*)&header, sizeof(BinaryCacheHeader));
+	if (!stream || std::memcmp(header.magic, "PTSC", 4) != 0 || header.version != BinaryCacheVersion ||
+		header.sourceHash != program.sourceHash || header.driverHash != DriverHash()) return false;
+
+	std::vector<char> binary = std::vector<char>(header.binarySize);
+	stream.read(binary.data(), header.binarySize);
+	if (!stream) return false;
+
+	// The driver may still refuse it (an update it didn't hash), then it gets compiled from source
+	int linked = 0;
+	glProgramBinary(program.rendererID, header.binaryFormat, binary.data(), header.binarySize);
+	glGetProgramiv(program.rendererID, GL_LINK_STATUS, &linked);
+	if (linked) print("Shader: loaded from cache " << program.cachePath);
+	return linked != 0;
+}
+
+void Shader::SaveBinary(const ShaderProgram& program) {
+	if (!BinariesSupported()) return;
+
+	int binarySize = 0;
+	glGetProgramiv(program.rendererID, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+	if (binarySize <= 0) return;
+
+	BinaryCacheHeader header = BinaryCacheHeader();
+	std::vector<char> binary = std::vector<char>(binarySize);
+	GLenum binaryFormat = 0;
+	glGetProgramBinary(program.rendererID, binarySize, &binarySize, &binaryFormat, binary.data());
+
+	std::memcpy(header.magic, "PTSC", 4);
+	header.version = BinaryCacheVersion;
+	header.sourceHash = program.sourceHash;
+	header.driverHash = DriverHash();
+	header.binaryFormat = binaryFormat;
+	header.binarySize = (uint32_t)binarySize;
+
+	// Another instance may be loading the same cache
+	const std::string tempPath = program.cachePath + ".tmp";
+	{
+		std::ofstream stream = std::ofstream(tempPath, std::ios::binary);
+		if (!stream) { print("ERROR: Couldn't write the shader cache " << program.cachePath); return; }
+		stream.write((const char*)&header, sizeof(BinaryCacheHeader));
+		stream.write(binary.data(), binarySize);
+	}
+
+	if (!ReplaceFile(tempPath, program.cachePath)) print("ERROR: Couldn't replace the shader cache " << program.cachePath);
 }
 
 
@@ -102,5 +356,46 @@ SSBO::SSBO() {
 SSBO::~SSBO() {};
 
 void SSBO::Bind(unsigned int bind) { glBindBufferBase(GL_SHADER_STORAGE_BUFFER, bind, buffer); }
-void SSBO::SendData(uint32_t size, void* data) { glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_DYNAMIC_DRAW); }
-void SSBO::Unbind() { glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0); }
\ No newline at end of file
+void SSBO::SendData(size_t size, void* data) { glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)size, data, GL_DYNAMIC_DRAW); }
+bool SSBO::Allocate(size_t size) {
+	if (!CanAddress(size)) return false;
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)size, nullptr, GL_DYNAMIC_DRAW);
+	return true;
+}
+bool SSBO::StreamData(size_t size, const void* data, size_t chunkSize) {
+	if (!Allocate(size)) return false;
+	StreamSubData(0, size, data, chunkSize);
+	return true;
+}
+void SSBO::StreamSubData(size_t offset, size_t size, const void* data, size_t chunkSize) {
+	for (size_t sent = 0; sent < size; sent += chunkSize)
+		SendSubData(offset + sent, std::min(chunkSize, size - sent), (const unsigned char*)data + sent);
+}
+void SSBO::SendSubData(size_t offset, size_t size, const void* data) { glBufferSubData(GL_SHADER_STORAGE_BUFFER, (GLintptr)offset, (GLsizeiptr)size, data); }
+void SSBO::GetData(size_t offset, size_t size, void* data) { glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, (GLintptr)offset, (GLsizeiptr)size, data); }
+void SSBO::Unbind() { glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0); }
+
+bool SSBO::CanAddress(size_t size) {
+	// The shaders would read past what the block addresses, so it's an error rather than a slow path
+	GLint64 maxSize = 0;
+	glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &maxSize);
+	if ((uint64_t)size <= (uint64_t)maxSize) return true;
+
+	print("ERROR: SSBO of " << size << " bytes is over the " << maxSize << " bytes a shader storage block can address");
+	return false;
+}
+
+
+// UBO
+
+UBO::UBO() {
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+};
+
+UBO::~UBO() {};
+
+void UBO::Bind(unsigned int bind) { glBindBufferBase(GL_UNIFORM_BUFFER, bind, buffer); }
+void UBO::SendData(uint32_t size, const void* data) { glBufferData(GL_UNIFORM_BUFFER, size, data, GL_DYNAMIC_DRAW); }
+void UBO::SendSubData(uint32_t offset, uint32_t size, const void* data) { glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data); }
+void UBO::Unbind() { glBindBuffer(GL_UNIFORM_BUFFER, 0); }
\ No newline at end of file
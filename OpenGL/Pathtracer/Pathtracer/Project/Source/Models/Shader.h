@@ -3,6 +3,11 @@
 
 //#include <stdio.h>
 #include <iostream>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <memory>
+#include <cstring>
 
 #include <glad/glad.h>
 #include <glfw3.h>
@@ -13,67 +18,123 @@
 
 enum class ShaderType {
 	VERTEX = 0,
-	FRAGMENT = 1
+	FRAGMENT = 1,
+	COMPUTE = 2
 };
 
 struct ShadersData {
 	std::string vertexSource;
 	std::string fragmentSource;
+	std::string computeSource; // When present the program is a compute program
+};
+
+// The GL program of a Shader, shared by its copies
+struct ShaderProgram {
+	unsigned int rendererID = 0;
+	std::unordered_map<std::string, int> uniformLocations = std::unordered_map<std::string, int>(); // Of every active uniform, read once linked
+
+	// Compiled and linked in the background (KHR_parallel_shader_compile), the first Bind waits for the result
+	bool linking = false;
+	unsigned int shaders[2] = {}; // Attached stages (compute only uses the first), for their compile logs
+	std::string cachePath;
+	uint64_t sourceHash = 0;
+
+	// Hot reload: what to parse again, and the program linking in the background until it replaces rendererID
+	std::string filepath;
+	std::vector<std::string> defines;
+	unsigned int reloadID = 0;
+	unsigned int reloadShaders[2] = {};
+	uint64_t reloadHash = 0;
 };
 
 class Shader {
 
 private:
-	unsigned int rendererID;
+	std::shared_ptr<ShaderProgram> program;
+
+	// Programs of this run loaded from the binary cache, and compiled from source
+	static int cachedPrograms;
+	static int compiledPrograms;
+	// Every program created, for the reloads
+	static std::vector<std::weak_ptr<ShaderProgram>> programs;
 
 public:
-	Shader() : rendererID(0){};
+	Shader() : program(std::make_shared<ShaderProgram>()) {};
+	// Linked programs are saved next to the source ("<shader>.glsl.cache"), and loaded from there while the sources
+	// (defines included) and the driver are the same
 	Shader(const char* filepath);
+	// Every define ("NAME VALUE") is inserted after the #version line of each stage
+	Shader(const char* filepath, const std::vector<std::string>& defines);
 	~Shader();
 
-private:
-	ShadersData Parse(const char* filepath);
-	void Compile(ShadersData sources, unsigned int* shaders);
-	void Create(ShadersData sources);
+	static inline int GetCachedPrograms() { return cachedPrograms; }
+	static inline int GetCompiledPrograms() { return compiledPrograms; }
 
+	// The programs made from filepath parse it again and compile in the background, they keep the old program bound until then.
+	// Saving without changes doesn't recompile
+	static void Reload(const std::string& filepath);
+	// Swaps in the reloaded programs that finished linking, the ones that failed keep the old program.
+	// Returns whether any was swapped, their uniforms are back to the defaults
+	static bool SwapReloaded();
 
-	inline unsigned int GetUniformLocation(std::string name) const { return glGetUniformLocation(this->rendererID, name.c_str()); }
+private:
+	static ShadersData Parse(const char* filepath, const std::vector<std::string>& defines = {});
+	static void Compile(const ShadersData& sources, unsigned int rendererID, unsigned int* shaders);
+	static unsigned int CompileCompute(const std::string& source, unsigned int rendererID);
+	// Compiles and links without waiting for the result
+	static void StartLink(const ShadersData& sources, unsigned int rendererID, unsigned int* shaders);
+	void Create(const char* filepath, const std::vector<std::string>& defines);
+	void FinishLink() const;
+	static void CacheUniformLocations(ShaderProgram& program);
+
+	static bool LoadBinary(ShaderProgram& program);
+	static void SaveBinary(const ShaderProgram& program);
+
+	// -1 for uniforms the program doesn't use, which glUniform ignores
+	inline int GetUniformLocation(const std::string& name) const {
+		auto found = this->program->uniformLocations.find(name);
+		return found != this->program->uniformLocations.end() ? found->second : -1;
+	}
 public:
+	// Waits for the program to link the first time
 	void Bind() const;
 	//void Unbind();
 
-	void SetUniformMat4(std::string name, const glm::mat4& matrix) const {
-		unsigned int location = GetUniformLocation(name);
+	// Compute programs only, the caller places the memory barriers it needs
+	void Dispatch(unsigned int groupsX, unsigned int groupsY = 1, unsigned int groupsZ = 1) const;
+
+	void SetUniformMat4(const std::string& name, const glm::mat4& matrix) const {
+		int location = GetUniformLocation(name);
 		glUniformMatrix4fv(location, 1, GL_FALSE, &matrix[0][0]);
 	}
 
-	void SetUniform4f(std::string name, float f1, float f2, float f3, float f4) const {
-		unsigned int location = GetUniformLocation(name);
+	void SetUniform4f(const std::string& name, float f1, float f2, float f3, float f4) const {
+		int location = GetUniformLocation(name);
 		glUniform4f(location, f1, f2, f3, f4);
 	}
 
-	void SetUniform3f(std::string name, float f1, float f2, float f3) const {
-		unsigned int location = GetUniformLocation(name);
+	void SetUniform3f(const std::string& name, float f1, float f2, float f3) const {
+		int location = GetUniformLocation(name);
 		glUniform3f(location, f1, f2, f3);
 	}
 
-	void SetUniform2f(std::string name, float f1, float f2) const {
-		unsigned int location = GetUniformLocation(name);
+	void SetUniform2f(const std::string& name, float f1, float f2) const {
+		int location = GetUniformLocation(name);
 		glUniform2f(location, f1, f2);
 	}
 
-	void SetUniformFloat(std::string name, float value) const {
-		unsigned int location = GetUniformLocation(name);
+	void SetUniformFloat(const std::string& name, float value) const {
+		int location = GetUniformLocation(name);
 		glUniform1f(location, value);
 	}
 
-	void SetUniformInt(std::string name, int value) const {
-		unsigned int location = GetUniformLocation(name);
+	void SetUniformInt(const std::string& name, int value) const {
+		int location = GetUniformLocation(name);
 		glUniform1i(location, value);
 	}
 
-	void SetUniformUInt(std::string name, unsigned int value) const {
-		unsigned int location = GetUniformLocation(name);
+	void SetUniformUInt(const std::string& name, unsigned int value) const {
+		int location = GetUniformLocation(name);
 		glUniform1ui(location, value);
 	}
 };
@@ -86,8 +147,67 @@ public:
 	~SSBO();
 
 	void Bind(unsigned int bind = 0);
-	void SendData(uint32_t size, void* data);
+	void SendData(size_t size, void* data);
+	// Leaves the data undefined, for filling it with SendSubData. False, and nothing allocated, when the size can't be addressed
+	bool Allocate(size_t size);
+	// Uploads the data chunkSize bytes at a time, so a mapped source is only paged in a chunk at a time
+	bool StreamData(size_t size, const void* data, size_t chunkSize);
+	void StreamSubData(size_t offset, size_t size, const void* data, size_t chunkSize);
+	void SendSubData(size_t offset, size_t size, const void* data);
+	void GetData(size_t offset, size_t size, void* data);
 	void Unbind();
+
+	// Whether a shader storage block can address that many bytes (GL_MAX_SHADER_STORAGE_BLOCK_SIZE), prints an error when not
+	static bool CanAddress(size_t size);
+};
+
+// Uniform buffer, the std140 blocks with its binding read it
+class UBO {
+	uint32_t buffer = 0;
+
+public:
+	UBO();
+	~UBO();
+
+	void Bind(unsigned int bind = 0);
+	void SendData(uint32_t size, const void* data);
+	void SendSubData(uint32_t offset, uint32_t size, const void* data);
+	void Unbind();
+};
+
+// SSBO mirroring a host array: it keeps a copy of the last upload and only sends the range from the first to the last element
+// that changed since, through SendSubData. A new size reallocates it. For small arrays that get edited now and then
+template <typename T>
+class TrackedSSBO {
+	SSBO ssbo;
+	std::vector<T> uploaded = std::vector<T>();
+	bool allocated = false;
+
+public:
+	// Returns whether anything went up
+	bool Upload(unsigned int bind, const std::vector<T>& data) {
+		auto same = [&](size_t i) { return std::memcmp(&data[i], &this->uploaded[i], sizeof(T)) == 0; };
+
+		if (this->allocated && data.size() == this->uploaded.size()) {
+			size_t first = 0, last = data.size();
+			while (first < last && same(first)) first++;
+			while (last > first && same(last - 1)) last--;
+			if (first == last) return false;
+
+			this->ssbo.Bind(bind);
+			this->ssbo.SendSubData(first * sizeof(T), (last - first) * sizeof(T), &data[first]);
+			std::copy(data.begin() + first, data.begin() + last, this->uploaded.begin() + first);
+		}
+		else {
+			this->ssbo.Bind(bind);
+			this->ssbo.SendData(data.size() * sizeof(T), (void*)data.data());
+			this->uploaded = data;
+			this->allocated = true;
+		}
+
+		this->ssbo.Unbind();
+		return true;
+	}
 };
 
 
@@ -0,0 +1,152 @@
+#include "ShaderWatcher.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+#include "Source/Utils.h"
+
+namespace {
+	bool IsShaderSource(const std::string& path) {
+		const std::string extension = ".glsl";
+		return path.size() > extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+	}
+
+	// Editors write a file in a few steps, each one reports it
+	void AddChanged(std::vector<std::string>& changed, const std::string& path) {
+		if (IsShaderSource(path) && std::find(changed.begin(), changed.end(), path) == changed.end()) changed.push_back(path);
+	}
+}
+
+#ifdef _WIN32
+
+namespace {
+	bool Listen(HANDLE handle, OVERLAPPED* overlapped, std::vector<unsigned char>& changes) {
+		return ReadDirectoryChangesW(handle, changes.data(), (DWORD)changes.size(), TRUE,
+			FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME, NULL, overlapped, NULL);
+	}
+}
+
+ShaderWatcher::ShaderWatcher(const char* directory) : directory(directory) {
+	HANDLE handle = CreateFileA(directory, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+	if (handle == INVALID_HANDLE_VALUE) { print("WARNING: Couldn't watch " << directory << ", shaders won't reload"); return; }
+	this->handle = handle;
+
+	OVERLAPPED* overlapped = new OVERLAPPED();
+	overlapped->hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+	this->overlapped = overlapped;
+
+	if (!Listen(handle, overlapped, this->changes)) print("WARNING: Couldn't watch " << directory << ", shaders won't reload");
+}
+
+ShaderWatcher::~ShaderWatcher() {
+	OVERLAPPED* overlapped = (OVERLAPPED*)this->overlapped;
+	if (this->handle) {
+		CancelIo(this->handle);
+		if (overlapped) { DWORD bytes = 0; GetOverlappedResult(this->handle, overlapped, &bytes, TRUE); }
+		CloseHandle(this->handle);
+	}
+	if (overlapped) {
+		CloseHandle(overlapped->hEvent);
+		delete overlapped;
+	}
+}
+
+std::vector<std::string> ShaderWatcher::Poll() {
+	std::vector<std::string> changed = std::vector<std::string>();
+	OVERLAPPED* overlapped = (OVERLAPPED*)this->overlapped;
+	if (!this->handle) return changed;
+
+	DWORD bytes = 0;
+	if (!GetOverlappedResult(this->handle, overlapped, &bytes, FALSE)) return changed; // Nothing yet
+
+	// Zero bytes: more changes than the buffer holds, they're lost
+	for (DWORD offset = 0; bytes > 0;) {
+		const FILE_NOTIFY_INFORMATION* change = (const FILE_NOTIFY_INFORMATION*)(this->changes.data() + offset);
+
+		if (change->Action == FILE_ACTION_MODIFIED || change->Action == FILE_ACTION_ADDED || change->Action == FILE_ACTION_RENAMED_NEW_NAME) {
+			const int nameLength = (int)(change->FileNameLength / sizeof(WCHAR));
+			std::string name = std::string(WideCharToMultiByte(CP_UTF8, 0, change->FileName, nameLength, NULL, 0, NULL, NULL), '\0');
+			WideCharToMultiByte(CP_UTF8, 0, change->FileName, nameLength, &name[0], (int)name.size(), NULL, NULL);
+			std::replace(name.begin(), name.end(), '\\', '/');
+			AddChanged(changed, this->directory + "/" + name);
+		}
+
+		if (change->NextEntryOffset == 0) break;
+		offset += change->NextEntryOffset;
+	}
+
+	ResetEvent(overlapped->hEvent);
+	Listen(this->handle, overlapped, this->changes);
+	return changed;
+}
+
+#elif defined(__linux__)
+
+ShaderWatcher::ShaderWatcher(const char* directory) : directory(directory) {
+	this->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (this->inotify == -1) { print("WARNING: Couldn't watch " << directory << ", shaders won't reload"); return; }
+
+	Watch(this->directory);
+}
+
+ShaderWatcher::~ShaderWatcher() {
+	if (this->inotify != -1) close(this->inotify);
+}
+
+// inotify watches a single directory, every subdirectory gets its own watch
+void ShaderWatcher::Watch(const std::string& directory) {
+	// Written and closed, or renamed over (editors that save to a temporary file)
+	const int watch = inotify_add_watch(this->inotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (watch == -1) { print("WARNING: Couldn't watch " << directory << ", its shaders won't reload"); return; }
+	this->watchedDirectories[watch] = directory;
+
+	DIR* entries = opendir(directory.c_str());
+	if (!entries) return;
+	while (dirent* entry = readdir(entries)) {
+		if (entry->d_type != DT_DIR || std::strcmp(entry->d_name, ".") == 0 || std::strcmp(entry->d_name, "..") == 0) continue;
+		Watch(directory + "/" + entry->d_name);
+	}
+	closedir(entries);
+}
+
+std::vector<std::string> ShaderWatcher::Poll() {
+	std::vector<std::string> changed = std::vector<std::string>();
+	if (this->inotify == -1) return changed;
+
+	alignas(inotify_event) char events[4096];
+	ssize_t bytes;
+	while ((bytes = read(this->inotify, events, sizeof(events))) > 0) {
+		for (ssize_t offset = 0; offset < bytes;) {
+			const inotify_event* event = (const inotify_event*)(events + offset);
+			offset += sizeof(inotify_event) + event->len;
+
+			auto watched = this->watchedDirectories.find(event->wd);
+			if (event->len == 0 || (event->mask & IN_ISDIR) || watched == this->watchedDirectories.end()) continue;
+			AddChanged(changed, watched->second + "/" + event->name);
+		}
+	}
+	return changed;
+}
+
+#else
+
+ShaderWatcher::ShaderWatcher(const char* directory) : directory(directory) {
+	print("WARNING: Shader reloading isn't supported on this platform");
+}
+
+ShaderWatcher::~ShaderWatcher() {}
+
+std::vector<std::string> ShaderWatcher::Poll() { return std::vector<std::string>(); }
+
+#endif
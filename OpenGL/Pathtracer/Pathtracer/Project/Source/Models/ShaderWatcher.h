@@ -0,0 +1,36 @@
+#ifndef SHADER_WATCHER_H
+#define SHADER_WATCHER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// Reports the .glsl files written under a directory (subdirectories included), for Shader::Reload.
+// inotify on Linux, ReadDirectoryChangesW on Windows, nothing elsewhere
+class ShaderWatcher {
+
+	std::string directory;
+
+#ifdef _WIN32
+	void* handle = nullptr;
+	void* overlapped = nullptr;
+	std::vector<unsigned char> changes = std::vector<unsigned char>(16384); // FILE_NOTIFY_INFORMATION entries
+#elif defined(__linux__)
+	int inotify = -1;
+	std::unordered_map<int, std::string> watchedDirectories = std::unordered_map<int, std::string>(); // By watch descriptor
+
+	void Watch(const std::string& directory);
+#endif
+
+public:
+	ShaderWatcher(const char* directory);
+	~ShaderWatcher();
+
+	ShaderWatcher(const ShaderWatcher&) = delete;
+	ShaderWatcher& operator=(const ShaderWatcher&) = delete;
+
+	// Never blocks. The paths are "<directory>/<subdirectory>/<name>.glsl", like the ones the Shaders were created from
+	std::vector<std::string> Poll();
+};
+
+#endif // !SHADER_WATCHER_H
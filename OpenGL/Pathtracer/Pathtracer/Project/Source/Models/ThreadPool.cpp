@@ -0,0 +1,88 @@
+#include "ThreadPool.h"
+
+namespace {
+	// Lets nested submits go to the calling worker own queue
+	thread_local const ThreadPool* currentPool = nullptr;
+	thread_local int currentWorker = -1;
+}
+
+ThreadPool::ThreadPool(unsigned int threadsCount) {
+	if (threadsCount == 0) threadsCount = std::thread::hardware_concurrency();
+	if (threadsCount == 0) threadsCount = 1;
+
+	for (unsigned int i = 0; i < threadsCount; i++) this->queues.push_back(std::make_unique<Queue>());
+	for (unsigned int i = 0; i < threadsCount - 1; i++) this->workers.emplace_back(&ThreadPool::WorkerLoop, this, (int)i);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(this->sleepMutex);
+		this->stopping = true;
+	}
+	this->wake.notify_all();
+
+	for (std::thread& worker : this->workers) worker.join();
+}
+
+int ThreadPool::CurrentQueue() const {
+	return currentPool == this ? currentWorker : (int)this->workers.size();
+}
+
+void ThreadPool::Submit(TaskGroup& group, std::function<void()> task) {
+	group.pending++;
+
+	Queue& queue = *this->queues[CurrentQueue()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back({ std::move(task), &group });
+	}
+	this->queuedCount++;
+
+	// Taking the lock makes sure a worker that just found nothing to do is already waiting
+	{ std::lock_guard<std::mutex> lock(this->sleepMutex); }
+	this->wake.notify_one();
+}
+
+bool ThreadPool::RunNext(int queueIndex) {
+	const int queuesCount = (int)this->queues.size();
+	Task task;
+	bool found = false;
+
+	// Own queue from the back, then steal from the front of the others
+	for (int i = 0; i < queuesCount && !found; i++) {
+		Queue& queue = *this->queues[(queueIndex + i) % queuesCount];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty()) continue;
+
+		if (i == 0) { task = std::move(queue.tasks.back()); queue.tasks.pop_back(); }
+		else { task = std::move(queue.tasks.front()); queue.tasks.pop_front(); }
+		found = true;
+	}
+
+	if (!found) return false;
+
+	this->queuedCount--;
+	task.function();
+	task.group->pending--;
+	return true;
+}
+
+void ThreadPool::WorkerLoop(int workerIndex) {
+	currentPool = this;
+	currentWorker = workerIndex;
+
+	while (true) {
+		if (RunNext(workerIndex)) continue;
+
+		std::unique_lock<std::mutex> lock(this->sleepMutex);
+		this->wake.wait(lock, [this]() { return this->stopping || this->queuedCount > 0; });
+		if (this->stopping && this->queuedCount == 0) return;
+	}
+}
+
+void ThreadPool::Wait(TaskGroup& group) {
+	const int queueIndex = CurrentQueue();
+	while (group.pending > 0) {
+		if (!RunNext(queueIndex)) std::this_thread::yield();
+	}
+}
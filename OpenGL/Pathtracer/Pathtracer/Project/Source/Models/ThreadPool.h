@@ -0,0 +1,60 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// Counts the unfinished tasks submitted with it, so a caller can wait on just its own work
+struct TaskGroup {
+	std::atomic<int> pending{ 0 };
+};
+
+// Work stealing thread pool:
+// Every worker owns a queue and runs its newest tasks first (depth first, like the sequential recursion),
+// idle workers steal the oldest tasks from the others, which are usually the biggest ones
+class ThreadPool {
+
+	struct Task {
+		std::function<void()> function;
+		TaskGroup* group;
+	};
+
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	std::vector<std::thread> workers = std::vector<std::thread>();
+	std::vector<std::unique_ptr<Queue>> queues = std::vector<std::unique_ptr<Queue>>(); // One per worker, the last one is for outside threads
+
+	std::atomic<int> queuedCount{ 0 };
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	bool stopping = false;
+
+public:
+	// 0 threads means one per hardware thread, the thread that waits works too so it counts as one of them
+	ThreadPool(unsigned int threadsCount = 0);
+	~ThreadPool();
+
+	void Submit(TaskGroup& group, std::function<void()> task);
+
+	// Runs queued tasks until every task of the group has finished
+	void Wait(TaskGroup& group);
+
+private:
+	void WorkerLoop(int workerIndex);
+	bool RunNext(int queueIndex);
+	int CurrentQueue() const;
+
+public:
+	inline unsigned int GetThreadsCount() const { return (unsigned int)this->workers.size() + 1; }
+};
+
+#endif // !THREAD_POOL_H
@@ -0,0 +1,9 @@
+#include "Timer.h"
+
+double Timer::GetMilliseconds() const {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - this->start).count();
+}
+
+double Timer::GetSeconds() const {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - this->start).count();
+}
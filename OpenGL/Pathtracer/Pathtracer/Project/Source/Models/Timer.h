@@ -0,0 +1,22 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <chrono>
+
+// Wall clock stopwatch, running since construction or the last Reset.
+// The readings live in Timer.cpp, away from the count() macro of Utils.h
+class Timer {
+
+	std::chrono::steady_clock::time_point start;
+
+public:
+	Timer() : start(std::chrono::steady_clock::now()) {};
+	~Timer() {};
+
+	void Reset() { this->start = std::chrono::steady_clock::now(); }
+
+	double GetMilliseconds() const;
+	double GetSeconds() const;
+};
+
+#endif // !TIMER_H
@@ -0,0 +1,158 @@
+#include "WideBVH.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Source/Utils.h"
+
+bool WideBVH::Collapse(const BVH& bvh) {
+	this->nodes.clear();
+	this->primIndices.clear();
+	this->overflowed = false;
+
+	const std::vector<BVHNode>& binary = bvh.GetNodes();
+	if (binary.empty()) return true;
+
+	if (binary[0].IsLeaf()) EmitRange(bvh.GetBounds(), binary[0].leftFirst, binary[0].primCount);
+	else EmitNode(bvh, 0);
+
+	if (this->overflowed) print("Wide BVH: " << bvh.GetPrimIndices().size() << " triangle references, over the leaves " << MaxLeafFirst + 1);
+	else if (StackNeed(0) > StackSize) {
+		print("Wide BVH: traversal needs " << StackNeed(0) << " stack entries, over " << StackSize);
+		this->overflowed = true;
+	}
+
+	if (this->overflowed) {
+		this->nodes.clear();
+		this->primIndices.clear();
+		return false;
+	}
+	return true;
+}
+
+unsigned int WideBVH::EmitNode(const BVH& bvh, unsigned int binaryNode) {
+	const std::vector<BVHNode>& binary = bvh.GetNodes();
+
+	const unsigned int wideNode = GetNodesCount();
+	this->nodes.resize(this->nodes.size() + NodeUints(this->width));
+
+	// Open the interior child with the biggest area until the node is full
+	std::vector<unsigned int> children = { (unsigned int)binary[binaryNode].leftFirst, (unsigned int)binary[binaryNode].leftFirst + 1 };
+	while (children.size() < this->width) {
+		int best = -1;
+		float bestArea = -1.0f;
+		for (int i = 0; i < children.size(); i++) {
+			const BVHNode& child = binary[children[i]];
+			if (child.IsLeaf()) continue;
+
+			AABB childBounds = { child.aabbMin, child.aabbMax };
+			if (childBounds.Area() > bestArea) { bestArea = childBounds.Area(); best = i; }
+		}
+		if (best == -1) break;
+
+		const unsigned int opened = children[best];
+		children[best] = binary[opened].leftFirst;
+		children.push_back(binary[opened].leftFirst + 1);
+	}
+
+	std::vector<AABB> childrenBounds = std::vector<AABB>();
+	std::vector<unsigned int> childrenMeta = std::vector<unsigned int>();
+	for (unsigned int c : children) {
+		const BVHNode& child = binary[c];
+		AABB childBounds = { child.aabbMin, child.aabbMax };
+
+		childrenBounds.push_back(childBounds);
+		if (!child.IsLeaf()) childrenMeta.push_back(EmitNode(bvh, c));
+		else if (child.primCount <= MaxLeafPrims) childrenMeta.push_back(LeafMeta(child.leftFirst, child.primCount));
+		else childrenMeta.push_back(EmitRange(childBounds, child.leftFirst, child.primCount));
+	}
+
+	WriteNode(wideNode, childrenBounds, childrenMeta);
+	return wideNode;
+}
+
+unsigned int WideBVH::EmitRange(const AABB& bounds, unsigned int first, unsigned int count) {
+	// Leaves too big for the meta bits: chunk them, every chunk keeps the bounds of the whole leaf
+
+	const unsigned int wideNode = GetNodesCount();
+	this->nodes.resize(this->nodes.size() + NodeUints(this->width));
+
+	const unsigned int chunksCount = (count + MaxLeafPrims - 1) / MaxLeafPrims;
+	const unsigned int childrenCount = std::min(chunksCount, (unsigned int)this->width);
+	const unsigned int childSize = (count + childrenCount - 1) / childrenCount;
+
+	std::vector<AABB> childrenBounds = std::vector<AABB>();
+	std::vector<unsigned int> childrenMeta = std::vector<unsigned int>();
+	for (unsigned int childFirst = first; childFirst < first + count; childFirst += childSize) {
+		const unsigned int childCount = std::min(childSize, first + count - childFirst);
+
+		childrenBounds.push_back(bounds);
+		if (childCount <= MaxLeafPrims) childrenMeta.push_back(LeafMeta(childFirst, childCount));
+		else childrenMeta.push_back(EmitRange(bounds, childFirst, childCount));
+	}
+
+	WriteNode(wideNode, childrenBounds, childrenMeta);
+	return wideNode;
+}
+
+unsigned int WideBVH::LeafMeta(unsigned int binaryFirst, unsigned int count) {
+	const unsigned int first = (unsigned int)this->primIndices.size();
+	if (first > MaxLeafFirst) { this->overflowed = true; return EmptyChild; }
+	for (unsigned int i = 0; i < count; i++) this->primIndices.push_back(binaryFirst + i);
+	return LeafFlag | (count << 24) | first;
+}
+
+int WideBVH::StackNeed(unsigned int wideNode) const {
+	// The shader pops a node and pushes its interior children, then goes on with one of them over the others
+	const unsigned int* meta = this->nodes.data() + wideNode * NodeUints(this->width) + 4 + 6 * this->width / 4;
+	int interiorCount = 0;
+	int childrenNeed = 0;
+	for (int c = 0; c < this->width && meta[c] != EmptyChild; c++) {
+		if (meta[c] & LeafFlag) continue;
+		interiorCount++;
+		childrenNeed = std::max(childrenNeed, StackNeed(meta[c]));
+	}
+	return std::max(1, interiorCount > 0 ? interiorCount - 1 + childrenNeed : 0);
+}
+
+void WideBVH::WriteNode(unsigned int wideNode, const std::vector<AABB>& childrenBounds, const std::vector<unsigned int>& childrenMeta) {
+	unsigned int* node = this->nodes.data() + wideNode * NodeUints(this->width);
+	unsigned char* quantized = (unsigned char*)(node + 4);
+	unsigned int* meta = node + 4 + 6 * this->width / 4;
+
+	AABB bounds = AABB();
+	for (const AABB& childBounds : childrenBounds) bounds.Grow(childBounds);
+
+	// Power of two scales keep q * scale exact, so the shader decodes exactly the same floats
+	float scale[3];
+	unsigned int exponents = 0;
+	for (int a = 0; a < 3; a++) {
+		int exponent = -126;
+		const float extent = bounds.max[a] - bounds.min[a];
+		if (extent > 0.0f) exponent = std::max(-126, (int)std::ceil(std::log2(extent / 255.0f)));
+		while (exponent < 127 && bounds.min[a] + 255.0f * std::ldexp(1.0f, exponent) < bounds.max[a]) exponent++;
+
+		scale[a] = std::ldexp(1.0f, exponent);
+		exponents |= (unsigned int)(exponent + 127) << (a * 8);
+		node[a] = glm::floatBitsToUint(bounds.min[a]);
+	}
+	node[3] = exponents;
+
+	for (int c = 0; c < this->width; c++) {
+		meta[c] = c < childrenMeta.size() ? childrenMeta[c] : EmptyChild;
+		if (c >= childrenBounds.size()) continue;
+
+		for (int a = 0; a < 3; a++) {
+			const float origin = bounds.min[a];
+
+			// Round outwards, then fix the float error of the division so the decoded box always contains the child
+			int lo = std::min(255, std::max(0, (int)std::floor((childrenBounds[c].min[a] - origin) / scale[a])));
+			while (lo > 0 && origin + lo * scale[a] > childrenBounds[c].min[a]) lo--;
+			int hi = std::min(255, std::max(0, (int)std::ceil((childrenBounds[c].max[a] - origin) / scale[a])));
+			while (hi < 255 && origin + hi * scale[a] < childrenBounds[c].max[a]) hi++;
+
+			quantized[a * this->width + c] = (unsigned char)lo;
+			quantized[(a + 3) * this->width + c] = (unsigned char)hi;
+		}
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include <vector>
+
+#include "BVH.h"
+
+// 4 or 8-ary BVH collapsed from a binary BVH, with the child bounds quantized to 8 bits in the parent frame.
+// Node layout (uints, matches meshTrace() with BVH_WIDTH > 2 in pathtracer.glsl):
+//  [0, 3)  frame origin (float bits)
+//  [3]     frame scale exponents, biased like float exponents: x | y << 8 | z << 16
+//  [4, 4 + 6 * width / 4)  quantized child bounds, one byte per child: lo.x[width], lo.y, lo.z, hi.x, hi.y, hi.z
+//  then one meta uint per child: EmptyChild | interior node index | LeafFlag, primitives count << 24, first primitive
+// Width 4 nodes are padded to 64 bytes (a cache line), width 8 nodes take 96 bytes
+class WideBVH {
+
+	int width;
+	bool overflowed = false; // A leaf first primitive didn't fit its meta bits, or the traversal went over StackSize
+	std::vector<unsigned int> nodes = std::vector<unsigned int>();
+	std::vector<unsigned int> primIndices = std::vector<unsigned int>(); // Leaves order -> binary BVH primitives order
+
+public:
+	static constexpr unsigned int EmptyChild = 0xFFFFFFFFu;
+	static constexpr unsigned int LeafFlag = 0x80000000u;
+	static constexpr int MaxLeafPrims = 127; // 7 bits of meta, bigger leaves get split
+	static constexpr unsigned int MaxLeafFirst = 0xFFFFFFu; // 24 bits of meta, so about 16M triangle references per BVH
+	static constexpr int StackSize = 64; // WIDE_STACK_SIZE in pathtracer.glsl, its pushes past it are dropped
+
+	WideBVH(int width = 4) : width(width) {};
+	~WideBVH() {};
+
+	// Children are taken greedily, always opening the interior child with the biggest surface area.
+	// False (and left empty) when the leaves reference more triangles than the meta bits address, or the traversal
+	// could overflow StackSize: the BVH has to be split
+	bool Collapse(const BVH& bvh);
+
+	static int NodeUints(int width) { return width == 4 ? 16 : 24; }
+
+private:
+	unsigned int EmitNode(const BVH& bvh, unsigned int binaryNode);
+	unsigned int EmitRange(const AABB& bounds, unsigned int first, unsigned int count);
+	void WriteNode(unsigned int wideNode, const std::vector<AABB>& childrenBounds, const std::vector<unsigned int>& childrenMeta);
+	unsigned int LeafMeta(unsigned int binaryFirst, unsigned int count);
+	int StackNeed(unsigned int wideNode) const;
+
+public:
+	inline int GetWidth() const { return this->width; }
+	inline const std::vector<unsigned int>& GetNodes() const { return this->nodes; }
+	inline const std::vector<unsigned int>& GetPrimIndices() const { return this->primIndices; }
+	inline unsigned int GetNodesCount() const { return (unsigned int)this->nodes.size() / NodeUints(this->width); }
+	inline unsigned int GetNodeBytes() const { return NodeUints(this->width) * sizeof(unsigned int); }
+};
+
+#endif // !WIDE_BVH_H